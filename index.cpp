@@ -2,19 +2,59 @@
 #include <vector>
 #include <string>
 #include <memory>
+#include <mutex>
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cassert>
+#include <cctype>
+#include <fstream>
+#include <new>
+#include <sstream>
+#include <thread>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <cstring>
+#include <functional>
+#include <utility>
+#include <climits>
+#include <cstdint>
+#include <cstdio>
 #include <cstdlib>
 #include <ctime>
-#include <typeinfo>
-#include <map>
+
+#ifdef _MSC_VER
+  #include <intrin.h>
+#endif
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+  #include <immintrin.h>
+  #define OCEAN_X86_KERNELS 1
+#endif
 
 #ifdef _WIN32
   #include <windows.h>
+  #define PSAPI_VERSION 2
+  #include <psapi.h>
+  #include <conio.h>
   // Cross-platform sleep function in milliseconds
   void sleepMs(int ms) {
     Sleep(ms);
   }
 #else
   #include <unistd.h>
+  #include <csignal>
+  #include <cerrno>
+  #include <fcntl.h>
+  #include <poll.h>
+  #include <sys/mman.h>
+  #include <sys/resource.h>
+  #include <sys/ioctl.h>
+  #include <sys/socket.h>
+  #include <sys/stat.h>
+  #include <sys/wait.h>
+  #include <termios.h>
   // Cross-platform sleep function in milliseconds
   void sleepMs(int ms) {
     usleep(ms * 1000);
@@ -22,771 +62,5781 @@
 #endif
 
 /**
- * Clears the console screen.
- * On Windows, we use FillConsoleOutputCharacter.
- * On other systems, we simply call system("clear").
+ * Peak resident set size of the process in KiB.
  */
-void clearScreen() {
+size_t peakRssKb() {
 #ifdef _WIN32
-  COORD topLeft = {0, 0};
-  HANDLE console = GetStdHandle(STD_OUTPUT_HANDLE);
-  CONSOLE_SCREEN_BUFFER_INFO screen;
-  DWORD written;
-  GetConsoleScreenBufferInfo(console, &screen);
-  FillConsoleOutputCharacterA(console, ' ', screen.dwSize.X * screen.dwSize.Y,
-    topLeft, &written);
-  FillConsoleOutputAttribute(console, FOREGROUND_GREEN | FOREGROUND_RED | FOREGROUND_BLUE,
-    screen.dwSize.X * screen.dwSize.Y, topLeft, &written);
-  SetConsoleCursorPosition(console, topLeft);
+  PROCESS_MEMORY_COUNTERS pmc;
+  if (GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof(pmc))) {
+    return pmc.PeakWorkingSetSize / 1024;
+  }
+  return 0;
+#else
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+  return usage.ru_maxrss / 1024;
 #else
-  std::system("clear");
+  return usage.ru_maxrss;
+#endif
 #endif
 }
 
+// ------------------ allocation accounting ------------------
+
 /**
- * Base class for all objects in the ocean.
- * Each object:
- *  - Has a display symbol
- *  - A tick() method to update its internal state
- *  - Can be "alive" or not
- *  - Has coordinates in the field
+ * Number of heap allocations made through operator new so far.
+ * Used by the benchmark to report allocations per tick.
  */
-struct Object {
-  virtual ~Object() = default;
-  virtual std::string getSymbol() const = 0;
-  virtual void tick() = 0;
-  virtual bool isAlive() const { return true; }
-  size_t x = 0;
-  size_t y = 0;
-  bool movedThisTurn = false;
-};
+std::atomic<uint64_t> gAllocationCount(0);
+
+void* operator new(size_t size) {
+  gAllocationCount.fetch_add(1, std::memory_order_relaxed);
+  if (void* p = std::malloc(size ? size : 1)) {
+    return p;
+  }
+  throw std::bad_alloc();
+}
+
+// Kept out of line: once inlined, GCC sees free() applied to memory from
+// operator new and reports a mismatched deallocation
+#ifdef __GNUC__
+__attribute__((noinline))
+#endif
+void operator delete(void* p) noexcept {
+  std::free(p);
+}
+
+#ifdef __cpp_sized_deallocation
+#ifdef __GNUC__
+__attribute__((noinline))
+#endif
+void operator delete(void* p, size_t) noexcept {
+  std::free(p);
+}
+#endif
+
+// ------------------ profiler ------------------
+
+#ifdef OCEAN_PROFILE
 
 /**
- * Represents an empty cell. We'll display it as "  " (two spaces).
+ * Parts of a run timed by --profile. The ones up to Idle are timed on the
+ * ticking thread and exclude each other: entering one pauses the one it
+ * interrupts. Decide, Neighbours and Apply are timed on every thread while
+ * it visits creatures, and make up most of Sweep; Neighbours is part of
+ * Decide. Those run for every creature, so they are only timed on one
+ * visit in kProfileSampleEvery and scaled up.
  */
-struct Empty : public Object {
-  std::string getSymbol() const override {
-    return "  ";
-  }
-  void tick() override {}
+enum class Phase : uint8_t {
+  Reserve,
+  Terrain,
+  Aging,
+  Sweep,
+  Halo,
+  Storm,
+  Settle,
+  Output,
+  // Rest of a tick, outside the phases above
+  Other,
+  Render,
+  // Between ticks and frames, not reported
+  Idle,
+  Decide,
+  Neighbours,
+  Apply,
+  Count
+};
+
+static const char* const kPhaseNames[] = {
+  "reserve", "terrain", "aging", "sweep", "halo", "storm", "settle", "output", "other",
+  "render", "idle", "decide", "neighbours", "apply"
 };
 
+static_assert(sizeof(kPhaseNames) / sizeof(kPhaseNames[0]) == static_cast<size_t>(Phase::Count),
+              "kPhaseNames must name every phase");
+
 /**
- * Stone (S). Eventually transforms into a Reef (R).
+ * Kinds of Action, counted separately.
  */
-struct Stone : public Object {
-  int turnsToReef;
+const size_t kActionKinds = 3;
 
-  Stone() {
-    // Extended duration so we can see more transformations
-    turnsToReef = 150 + rand() % 50;
-  }
+const uint64_t kProfileSampleEvery = 16;
 
-  std::string getSymbol() const override {
-    return "S ";
+/**
+ * Clock of the profiler: the time stamp counter where there is one,
+ * steady_clock nanoseconds otherwise. Profiler::report() converts it to
+ * time by comparing it with steady_clock over the whole run.
+ */
+inline uint64_t profileClock() {
+#if defined(OCEAN_X86_KERNELS)
+  return __builtin_ia32_rdtsc();
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+  return __rdtsc();
+#else
+  return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count());
+#endif
+}
+
+/**
+ * What one thread measured: clock ticks and heap allocations per phase,
+ * creatures visited and how many of those visits were timed, neighbour
+ * cells looked at, actions tried and applied by kind, and frames drawn.
+ */
+struct ProfileCounters {
+  uint64_t time[static_cast<size_t>(Phase::Count)];
+  uint64_t allocations[static_cast<size_t>(Phase::Count)];
+  uint64_t visits;
+  uint64_t timedVisits;
+  uint64_t neighbourCells;
+  uint64_t actionsTried[kActionKinds];
+  uint64_t actionsApplied[kActionKinds];
+  uint64_t frames;
+  // Whether the current visit is timed
+  bool timing;
+
+  ProfileCounters()
+    : time(), allocations(), visits(0), timedVisits(0), neighbourCells(0), actionsTried(),
+      actionsApplied(), frames(0), timing(false) {}
+
+  void startVisit() {
+    timing = ++visits % kProfileSampleEvery == 0;
+    timedVisits += timing;
   }
 
-  void tick() override {
-    if (turnsToReef > 0) {
-      turnsToReef--;
+  void add(const ProfileCounters& o) {
+    for (size_t p = 0; p < static_cast<size_t>(Phase::Count); ++p) {
+      time[p] += o.time[p];
+      allocations[p] += o.allocations[p];
     }
+    visits += o.visits;
+    timedVisits += o.timedVisits;
+    neighbourCells += o.neighbourCells;
+    for (size_t a = 0; a < kActionKinds; ++a) {
+      actionsTried[a] += o.actionsTried[a];
+      actionsApplied[a] += o.actionsApplied[a];
+    }
+    frames += o.frames;
   }
+};
+
+/**
+ * Adds the time spent in its scope to a phase of one thread's counters,
+ * unless they are null.
+ */
+class ProfileTimer {
+public:
+  ProfileTimer(ProfileCounters* c, Phase p)
+    : counters(c), phase(static_cast<size_t>(p)), start(c ? profileClock() : 0) {}
 
-  bool isReadyToTransform() const {
-    return (turnsToReef <= 0);
+  ~ProfileTimer() {
+    if (counters) counters->time[phase] += profileClock() - start;
   }
+
+private:
+  ProfileCounters* counters;
+  size_t phase;
+  uint64_t start;
 };
 
 /**
- * Reef (R). Transforms back into Stone (S).
+ * Profile of a run, kept on the ticking thread: its exclusive phase times
+ * and allocations, and the length of every tick.
  */
-struct Reef : public Object {
-  int turnsToStone;
-  
-  Reef() {
-    turnsToStone = 300 + rand() % 50;
-  }
+class Profiler {
+public:
+  bool on() const { return enabled; }
 
-  std::string getSymbol() const override {
-    return "R ";
+  void start() {
+    enabled = true;
+    active = Phase::Idle;
+    since = startClock = profileClock();
+    startTime = std::chrono::steady_clock::now();
+    allocationsSince = gAllocationCount.load(std::memory_order_relaxed);
   }
 
-  void tick() override {
-    if (turnsToStone > 0) {
-      turnsToStone--;
-    }
+  /**
+   * Charges the active phase and makes p active. Returns the phase it
+   * interrupted, for leave().
+   */
+  Phase enter(Phase p) {
+    charge();
+    Phase previous = active;
+    active = p;
+    return previous;
   }
 
-  bool isReadyToTransform() const {
-    return (turnsToStone <= 0);
+  void leave(Phase previous) {
+    charge();
+    active = previous;
   }
-};
-
-/**
- * Prey (~). Flees from predators and can reproduce.
- */
-struct Prey : public Object {
-  int age;
-  int maxAge;
-  bool adult;
-  int reproduceCountdown;
 
-  Prey() {
-    // Longer lifespan
-    maxAge = 800 + rand() % 200;
-    age = 0;
-    adult = false;
-    // Delayed reproduction
-    reproduceCountdown = 80 + rand() % 20;
+  void beginTick() {
+    enter(Phase::Other);
+    tickStart = since;
   }
 
-  std::string getSymbol() const override {
-    return "~ ";
+  void endTick() {
+    leave(Phase::Idle);
+    tickLengths.push_back(since - tickStart);
   }
 
-  void tick() override {
-    age++;
-    if (age > (maxAge / 3)) {
-      adult = true;
+  ProfileCounters& counters() { return main; }
+
+  /**
+   * Prints the time, share and allocations of every phase, the tick
+   * length percentiles and the counters, with the counters of the other
+   * threads added in.
+   */
+  void report(std::ostream& out, const ProfileCounters& workers, size_t threads) const {
+    ProfileCounters all = main;
+    all.add(workers);
+    std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - startTime;
+    double nsPerTick = elapsed.count() > 0
+        ? elapsed.count() / static_cast<double>(profileClock() - startClock) : 1.0;
+    size_t ticks = tickLengths.size();
+    uint64_t tickTotal = 0;
+    for (uint64_t t : tickLengths) {
+      tickTotal += t;
     }
-    if (age > maxAge) {
-      adult = false;
+    char line[160];
+    std::snprintf(line, sizeof(line), "Profile of %llu ticks on %llu thread%s\n",
+                  static_cast<unsigned long long>(ticks), static_cast<unsigned long long>(threads),
+                  threads == 1 ? "" : "s");
+    out << line;
+    std::snprintf(line, sizeof(line), "%-12s %12s %12s %7s %12s\n", "phase", "total ms",
+                  "us/tick", "share", "allocations");
+    out << line;
+    for (size_t p = 0; p < static_cast<size_t>(Phase::Count); ++p) {
+      if (p == static_cast<size_t>(Phase::Idle)) continue;
+      bool perThread = p > static_cast<size_t>(Phase::Idle);
+      bool render = p == static_cast<size_t>(Phase::Render);
+      double scale = perThread && all.timedVisits
+          ? static_cast<double>(all.visits) / all.timedVisits : 1.0;
+      double ms = all.time[p] * scale * nsPerTick / 1e6;
+      size_t per = render ? all.frames : ticks;
+      std::snprintf(line, sizeof(line), "%-12s %12.3f %12.3f %6.1f%% %12s\n",
+                    (std::string(perThread ? "  " : "") + kPhaseNames[p] + (render ? "/frame" : "") +
+                     (perThread && threads > 1 ? "*" : "")).c_str(),
+                    ms, per ? ms * 1e3 / per : 0.0,
+                    tickTotal && !render ? 100.0 * all.time[p] * scale / tickTotal : 0.0,
+                    perThread ? "" : std::to_string(all.allocations[p]).c_str());
+      out << line;
     }
-    if (reproduceCountdown > 0) {
-      reproduceCountdown--;
+    std::snprintf(line, sizeof(line), "  (%s timed on %llu of %llu creature visits%s)\n",
+                  "decide, neighbours and apply",
+                  static_cast<unsigned long long>(all.timedVisits),
+                  static_cast<unsigned long long>(all.visits),
+                  threads > 1 ? ", * summed over the threads" : "");
+    out << line;
+    if (ticks > 0) {
+      std::vector<uint64_t> sorted(tickLengths);
+      std::sort(sorted.begin(), sorted.end());
+      std::snprintf(line, sizeof(line), "tick us: p50 %.1f, p99 %.1f, max %.1f, mean %.1f\n",
+                    sorted[ticks / 2] * nsPerTick / 1e3,
+                    sorted[std::min(ticks - 1, ticks * 99 / 100)] * nsPerTick / 1e3,
+                    sorted.back() * nsPerTick / 1e3, tickTotal * nsPerTick / 1e3 / ticks);
+      out << line;
     }
+    uint64_t allocations = 0;
+    for (size_t p = 0; p < static_cast<size_t>(Phase::Count); ++p) {
+      if (p != static_cast<size_t>(Phase::Idle)) allocations += all.allocations[p];
+    }
+    std::snprintf(line, sizeof(line), "allocations: %llu (%.2f per tick)\n",
+                  static_cast<unsigned long long>(allocations),
+                  ticks ? static_cast<double>(allocations) / ticks : 0.0);
+    out << line;
+    std::snprintf(line, sizeof(line), "neighbour cells visited: %llu (%.1f per tick)\n",
+                  static_cast<unsigned long long>(all.neighbourCells),
+                  ticks ? static_cast<double>(all.neighbourCells) / ticks : 0.0);
+    out << line;
+    const char* kinds[kActionKinds] = {"move", "eat", "storm"};
+    out << "actions applied/tried:";
+    for (size_t a = 0; a < kActionKinds; ++a) {
+      out << (a ? ", " : " ") << kinds[a] << " " << all.actionsApplied[a] << "/"
+          << all.actionsTried[a];
+    }
+    out << std::endl;
   }
 
-  bool isAlive() const override {
-    return (age <= maxAge);
+private:
+  void charge() {
+    uint64_t now = profileClock();
+    uint64_t allocations = gAllocationCount.load(std::memory_order_relaxed);
+    main.time[static_cast<size_t>(active)] += now - since;
+    main.allocations[static_cast<size_t>(active)] += allocations - allocationsSince;
+    since = now;
+    allocationsSince = allocations;
   }
 
-  bool canReproduce() const {
-    return (adult && reproduceCountdown == 0);
+  bool enabled = false;
+  Phase active = Phase::Idle;
+  uint64_t since = 0;
+  uint64_t startClock = 0;
+  uint64_t tickStart = 0;
+  uint64_t allocationsSince = 0;
+  std::chrono::steady_clock::time_point startTime;
+  ProfileCounters main;
+  std::vector<uint64_t> tickLengths;
+};
+
+/**
+ * Makes a phase of the ticking thread active for its scope, if the
+ * profiler is on.
+ */
+class PhaseScope {
+public:
+  PhaseScope(Profiler& p, Phase phase) : profiler(p.on() ? &p : nullptr), previous(Phase::Idle) {
+    if (profiler) previous = profiler->enter(phase);
   }
 
-  void resetReproduce() {
-    reproduceCountdown = 80 + rand() % 20;
+  ~PhaseScope() {
+    if (profiler) profiler->leave(previous);
   }
+
+private:
+  Profiler* profiler;
+  Phase previous;
 };
 
 /**
- * Predator (P). Hunts Prey (~). Avoids Apex (A). Has hunger; dies if too hungry.
+ * Times one tick of the ticking thread, if the profiler is on.
  */
-struct Predator : public Object {
-  int age;
-  int maxAge;
-  bool adult;
-  int hunger;
-  int hungerLimit;
-  int reproduceCountdown;
-
-  Predator() {
-    maxAge = 1000 + rand() % 200;
-    age = 0;
-    adult = false;
-    hunger = 0;
-    hungerLimit = 50;
-    reproduceCountdown = 120 + rand() % 30;
+class TickScope {
+public:
+  explicit TickScope(Profiler& p) : profiler(p.on() ? &p : nullptr) {
+    if (profiler) profiler->beginTick();
   }
 
-  std::string getSymbol() const override {
-    return "P ";
+  ~TickScope() {
+    if (profiler) profiler->endTick();
   }
 
-  void tick() override {
-    age++;
-    hunger++;
-    if (age > (maxAge / 3)) {
-      adult = true;
-    }
-    if (age > maxAge) {
-      adult = false;
-    }
-    if (reproduceCountdown > 0) {
-      reproduceCountdown--;
-    }
-  }
+private:
+  Profiler* profiler;
+};
 
-  bool isAlive() const override {
-    if (age > maxAge) return false;
-    if (hunger > hungerLimit) return false;
-    return true;
-  }
+#define OCEAN_PROFILE_TICK(profiler) TickScope profileTick(profiler)
+#define OCEAN_PROFILE_PHASE(profiler, phase) PhaseScope profilePhase(profiler, phase)
+#define OCEAN_PROFILE_TIME(counters, phase) ProfileTimer profileTimer(counters, phase)
+#define OCEAN_PROFILE_COUNT(counters, field, n) \
+  do { if (ProfileCounters* c_ = (counters)) c_->field += (n); } while (0)
+#define OCEAN_PROFILE_VISIT(counters) \
+  do { if (ProfileCounters* c_ = (counters)) c_->startVisit(); } while (0)
 
-  bool isHungry() const {
-    return (hunger > 10);
-  }
+#else
 
-  void feed() {
-    hunger = 0;
-  }
+struct ProfileCounters;
 
-  bool canReproduce() const {
-    return (adult && reproduceCountdown == 0 && !isHungry());
-  }
+// Without OCEAN_PROFILE the probes compile to nothing; the counters they
+// name are only looked at in an unevaluated context
+#define OCEAN_PROFILE_TICK(profiler) do {} while (0)
+#define OCEAN_PROFILE_PHASE(profiler, phase) do {} while (0)
+#define OCEAN_PROFILE_TIME(counters, phase) do { (void)sizeof(counters); } while (0)
+#define OCEAN_PROFILE_COUNT(counters, field, n) do { (void)sizeof(counters); } while (0)
+#define OCEAN_PROFILE_VISIT(counters) do { (void)sizeof(counters); } while (0)
 
-  void resetReproduce() {
-    reproduceCountdown = 120 + rand() % 30;
-  }
+#endif
+
+/**
+ * Type tag stored for every cell of the ocean.
+ */
+enum class Species : uint8_t {
+  Empty,
+  Stone,
+  Reef,
+  Prey,
+  Predator,
+  ApexPredator,
+  Count
 };
 
 /**
- * Apex predator (A). Can eat both Prey and Predator if hungry enough.
+ * Wraps a (possibly negative) coordinate onto a toroidal axis of length n.
+ */
+inline size_t wrap(long long v, size_t n) {
+  long long m = v % static_cast<long long>(n);
+  return static_cast<size_t>(m < 0 ? m + static_cast<long long>(n) : m);
+}
+
+/**
+ * Index of the lowest set bit of a non-zero word.
+ */
+inline int lowestBit(uint64_t v) {
+#ifdef _MSC_VER
+  unsigned long i;
+  _BitScanForward64(&i, v);
+  return static_cast<int>(i);
+#else
+  return __builtin_ctzll(v);
+#endif
+}
+
+/**
+ * Number of set bits in a word.
+ */
+inline int popCount(uint64_t v) {
+#ifdef _MSC_VER
+  return static_cast<int>(__popcnt64(v));
+#else
+  return __builtin_popcountll(v);
+#endif
+}
+
+/**
+ * Independent random streams. Each use of randomness draws from its own
+ * stream so that adding a draw in one place does not shift the others.
+ */
+enum class RngStream : uint32_t {
+  Init,
+  Act,
+  Terrain,
+  Storm
+};
+
+/**
+ * SplitMix64 finalizer: a cheap, well-mixed 64-bit bijection.
+ */
+inline uint64_t mix64(uint64_t z) {
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+  return z ^ (z >> 31);
+}
+
+/**
+ * Counter-based random number generator.
+ * Every draw is a pure function of (seed, tick, cell, stream, counter), so
+ * the numbers a cell sees do not depend on the order in which cells are
+ * updated or on how many threads update them. There is no shared state.
  */
-struct ApexPredator : public Object {
-  int age;
-  int maxAge;
-  bool adult;
-  int hunger;
-  int hungerLimit;
-  int evolveHungerThreshold;
-  int speed;
-  int reproduceCountdown;
+class CellRng {
+public:
+  CellRng(uint64_t seed, uint64_t tick, uint64_t cell, RngStream stream)
+    : key(mix64(mix64(mix64(seed + 0x9e3779b97f4a7c15ULL) ^ tick) ^ cell)
+          ^ static_cast<uint64_t>(stream)),
+      counter(0) {}
 
-  ApexPredator() {
-    maxAge = 1200 + rand() % 300;
-    age = 0;
-    adult = false;
-    hunger = 0;
-    hungerLimit = 60;
-    evolveHungerThreshold = 15;
-    speed = 1;
-    reproduceCountdown = 200 + rand() % 50;
+  uint32_t next() {
+    return static_cast<uint32_t>(mix64(key + (++counter) * 0x9e3779b97f4a7c15ULL) >> 32);
   }
 
-  std::string getSymbol() const override {
-    return "A ";
+  /**
+   * Uniform value in [0, n).
+   */
+  int below(int n) {
+    return static_cast<int>((static_cast<uint64_t>(next()) * static_cast<uint32_t>(n)) >> 32);
   }
 
-  void tick() override {
-    age++;
-    hunger++;
-    if (age > (maxAge / 4)) {
-      adult = true;
-    }
-    if (age > maxAge) {
-      adult = false;
-    }
-    // Increase speed if hunger crosses thresholds
-    if (hunger > evolveHungerThreshold && speed == 1) {
-      speed = 2;
-    }
-    if (hunger > (evolveHungerThreshold + 20) && speed == 2) {
-      speed = 3;
-    }
-    if (reproduceCountdown > 0) {
-      reproduceCountdown--;
+private:
+  uint64_t key;
+  uint64_t counter;
+};
+
+/**
+ * Slot value of cells that have no record in any pool. Empty cells all
+ * share this sentinel instead of owning storage of their own.
+ */
+const uint32_t kNoSlot = 0xffffffffu;
+
+/**
+ * Cell index returned by searches that found nothing.
+ */
+const size_t kNoCell = static_cast<size_t>(-1);
+
+/**
+ * Arena of object records for one species, stored as packed per-field
+ * arrays. Released slots go on a free list and are recycled by the next
+ * allocation. Fields a species does not use stay at zero.
+ */
+struct CreaturePool {
+  std::vector<int32_t> age;
+  std::vector<int32_t> maxAge;
+  std::vector<int32_t> hunger;
+  std::vector<int32_t> reproduceCountdown;
+  // turnsToReef for a Stone, turnsToStone for a Reef, as first drawn
+  std::vector<int32_t> turnsToTransform;
+  // Tick on which a Stone or Reef transforms
+  std::vector<uint64_t> dueTick;
+  std::vector<uint8_t> speed;
+  std::vector<uint8_t> adult;
+  // AgingFlags computed by the aging pass of the current tick
+  std::vector<uint8_t> flags;
+  // Cell each record occupies, kept current by CellStore
+  std::vector<size_t> cell;
+  std::vector<uint32_t> freeSlots;
+  // Slots in use, in no particular order, and each one's position in it
+  std::vector<uint32_t> liveSlots;
+  std::vector<uint32_t> livePos;
+  size_t live = 0;
+  size_t highWater = 0;
+  // One past the highest slot ever handed out
+  size_t topSlot = 0;
+  // Guards the free list while tiles are updated in parallel
+  std::mutex mutex;
+
+  size_t capacity() const { return age.size(); }
+
+  /**
+   * Grows the arrays so that at least n allocations can be served from the
+   * free list. Called between ticks so that allocate() never moves the
+   * arrays while other threads are reading them.
+   */
+  void reserveSpare(size_t n) {
+    if (freeSlots.size() >= n) return;
+    size_t oldSize = capacity();
+    size_t newSize = std::max(oldSize * 2, oldSize + n - freeSlots.size());
+    age.resize(newSize);
+    maxAge.resize(newSize);
+    hunger.resize(newSize);
+    reproduceCountdown.resize(newSize);
+    turnsToTransform.resize(newSize);
+    dueTick.resize(newSize);
+    speed.resize(newSize);
+    adult.resize(newSize);
+    flags.resize(newSize);
+    cell.resize(newSize);
+    livePos.resize(newSize);
+    freeSlots.reserve(newSize);
+    liveSlots.reserve(newSize);
+    // Hand out low slots first
+    for (size_t i = newSize; i-- > oldSize;) {
+      freeSlots.push_back(static_cast<uint32_t>(i));
     }
   }
 
-  bool isAlive() const override {
-    if (age > maxAge) return false;
-    if (hunger > hungerLimit) return false;
-    return true;
+  /**
+   * Takes a zeroed slot from the free list.
+   */
+  uint32_t allocate() {
+    uint32_t i;
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      if (freeSlots.empty()) {
+        reserveSpare(1);
+      }
+      i = freeSlots.back();
+      freeSlots.pop_back();
+      livePos[i] = static_cast<uint32_t>(liveSlots.size());
+      liveSlots.push_back(i);
+      live++;
+      highWater = std::max(highWater, live);
+      topSlot = std::max<size_t>(topSlot, i + 1);
+    }
+    age[i] = 0;
+    maxAge[i] = 0;
+    hunger[i] = 0;
+    reproduceCountdown[i] = 0;
+    turnsToTransform[i] = 0;
+    dueTick[i] = 0;
+    speed[i] = 0;
+    adult[i] = 0;
+    flags[i] = 0;
+    return i;
   }
 
-  bool canEatPredator() const {
-    return (speed == 3);
+  void release(uint32_t i) {
+    std::lock_guard<std::mutex> lock(mutex);
+    freeSlots.push_back(i);
+    uint32_t moved = liveSlots.back();
+    liveSlots[livePos[i]] = moved;
+    livePos[moved] = livePos[i];
+    liveSlots.pop_back();
+    live--;
   }
 
-  bool isHungry() const {
-    return (hunger > 10);
+  /**
+   * Bytes used by one record across all arrays.
+   */
+  static size_t bytesPerRecord() {
+    return 5 * sizeof(int32_t) + 3 * sizeof(uint8_t) + sizeof(size_t) + sizeof(uint64_t) +
+           3 * sizeof(uint32_t);
   }
+};
 
-  void feed() {
-    hunger = 0;
-    speed = 1;
-  }
+// ------------------ aging kernel ------------------
 
-  bool canReproduce() const {
-    return (adult && reproduceCountdown == 0 && !isHungry());
-  }
+/*
+ * How a species ages each tick comes from its rules (see ClassicRules),
+ * given to the kernels as a type A so that every constant is known at
+ * compile time:
+ *  - hungerStep: hunger gained per tick;
+ *  - hungerLimit: dies once hunger goes above this;
+ *  - speed2At, speed3At: speed goes from 1 to 2 once hunger is above
+ *    speed2At, from 2 to 3 above speed3At;
+ *  - adultDivisor: adult once older than maxAge / adultDivisor.
+ * Creatures without hunger use a step of 0 and INT_MAX for the limits.
+ */
 
-  void resetReproduce() {
-    reproduceCountdown = 200 + rand() % 50;
-  }
+/**
+ * Per-record results of the aging pass, read by the behaviour phase.
+ */
+enum AgingFlags : uint8_t {
+  // The record went through the aging pass this tick
+  kAged = 1,
+  // Dead before aging: the cell is cleared when visited
+  kDead = 2,
+  // Dead after aging: the creature does not act any more
+  kDying = 4,
+  // Adult with its reproduction countdown at zero
+  kReady = 8
 };
 
 /**
- * Base Action class used by objects to modify the ocean state.
+ * Ages one record: a living creature gets one tick older and hungrier,
+ * becomes adult past maxAge / adultDivisor (and stops being one past
+ * maxAge), speeds up when starving and counts down to its next birth. Dead
+ * records are left as they are. This is the reference for the vector
+ * versions below.
  */
-struct Action {
-  Action(std::shared_ptr<Object> obj) : obj(obj) {}
-  virtual ~Action() = default;
+template <class A>
+inline void ageRecord(CreaturePool& p, size_t i) {
+  if (p.age[i] > p.maxAge[i] || p.hunger[i] > A::hungerLimit) {
+    p.flags[i] = kAged | kDead;
+    return;
+  }
+  p.age[i]++;
+  p.hunger[i] += A::hungerStep;
+  // age > maxAge / d is age * d > maxAge for whole non-negative numbers
+  if (p.age[i] * A::adultDivisor > p.maxAge[i]) {
+    p.adult[i] = 1;
+  }
+  if (p.age[i] > p.maxAge[i]) {
+    p.adult[i] = 0;
+  }
+  if (p.hunger[i] > A::speed2At && p.speed[i] == 1) {
+    p.speed[i] = 2;
+  }
+  if (p.hunger[i] > A::speed3At && p.speed[i] == 2) {
+    p.speed[i] = 3;
+  }
+  if (p.reproduceCountdown[i] > 0) {
+    p.reproduceCountdown[i]--;
+  }
+  uint8_t f = kAged;
+  if (p.age[i] > p.maxAge[i] || p.hunger[i] > A::hungerLimit) f |= kDying;
+  if (p.adult[i] && p.reproduceCountdown[i] == 0) f |= kReady;
+  p.flags[i] = f;
+}
+
+/**
+ * Ages the records in [begin, end) of a pool.
+ */
+typedef void (*AgingKernel)(CreaturePool& p, size_t begin, size_t end);
 
-  bool operator()(std::vector<std::shared_ptr<Object>>& field, size_t rows, size_t cols) {
-    return apply(field, rows, cols);
+template <class A>
+void ageScalar(CreaturePool& p, size_t begin, size_t end) {
+  for (size_t i = begin; i < end; ++i) {
+    ageRecord<A>(p, i);
   }
+}
 
-protected:
-  virtual bool apply(std::vector<std::shared_ptr<Object>>& field, size_t rows, size_t cols) = 0;
-  std::shared_ptr<Object> obj;
-};
+#ifdef OCEAN_X86_KERNELS
 
 /**
- * NoAction: an object does nothing this turn.
+ * SSE4.1 version: four records per step. Lanes compute what ageRecord()
+ * does with compares and blends; byte fields are widened to 32 bits.
  */
-struct NoAction : public Action {
-  NoAction(std::shared_ptr<Object> obj) : Action(obj) {}
-private:
-  bool apply(std::vector<std::shared_ptr<Object>>&, size_t, size_t) override {
-    return true;
+template <class A>
+__attribute__((target("sse4.1")))
+void ageSse41(CreaturePool& p, size_t begin, size_t end) {
+  const __m128i one = _mm_set1_epi32(1);
+  const __m128i two = _mm_set1_epi32(2);
+  const __m128i three = _mm_set1_epi32(3);
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i step = _mm_set1_epi32(A::hungerStep);
+  const __m128i limit = _mm_set1_epi32(A::hungerLimit);
+  const __m128i speed2At = _mm_set1_epi32(A::speed2At);
+  const __m128i speed3At = _mm_set1_epi32(A::speed3At);
+  const __m128i divisor = _mm_set1_epi32(A::adultDivisor);
+  size_t i = begin;
+  for (; i + 4 <= end; i += 4) {
+    __m128i age = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&p.age[i]));
+    __m128i maxAge = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&p.maxAge[i]));
+    __m128i hunger = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&p.hunger[i]));
+    __m128i countdown = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&p.reproduceCountdown[i]));
+    int32_t speedBytes, adultBytes;
+    std::memcpy(&speedBytes, &p.speed[i], 4);
+    std::memcpy(&adultBytes, &p.adult[i], 4);
+    __m128i speed = _mm_cvtepu8_epi32(_mm_cvtsi32_si128(speedBytes));
+    __m128i adult = _mm_cvtepu8_epi32(_mm_cvtsi32_si128(adultBytes));
+
+    __m128i dead = _mm_or_si128(_mm_cmpgt_epi32(age, maxAge), _mm_cmpgt_epi32(hunger, limit));
+    __m128i live = _mm_andnot_si128(dead, _mm_set1_epi32(-1));
+
+    __m128i newAge = _mm_sub_epi32(age, live);
+    __m128i newHunger = _mm_add_epi32(hunger, _mm_and_si128(live, step));
+    __m128i newAdult = _mm_blendv_epi8(adult, one,
+        _mm_cmpgt_epi32(_mm_mullo_epi32(newAge, divisor), maxAge));
+    newAdult = _mm_andnot_si128(_mm_cmpgt_epi32(newAge, maxAge), newAdult);
+    __m128i newSpeed = _mm_blendv_epi8(speed, two,
+        _mm_and_si128(_mm_cmpgt_epi32(newHunger, speed2At), _mm_cmpeq_epi32(speed, one)));
+    newSpeed = _mm_blendv_epi8(newSpeed, three,
+        _mm_and_si128(_mm_cmpgt_epi32(newHunger, speed3At), _mm_cmpeq_epi32(newSpeed, two)));
+    __m128i newCountdown = _mm_add_epi32(countdown,
+        _mm_and_si128(_mm_cmpgt_epi32(countdown, zero), _mm_set1_epi32(-1)));
+
+    newAdult = _mm_blendv_epi8(newAdult, adult, dead);
+    newSpeed = _mm_blendv_epi8(newSpeed, speed, dead);
+    newCountdown = _mm_blendv_epi8(newCountdown, countdown, dead);
+
+    __m128i dying = _mm_or_si128(_mm_cmpgt_epi32(newAge, maxAge), _mm_cmpgt_epi32(newHunger, limit));
+    __m128i ready = _mm_andnot_si128(_mm_cmpeq_epi32(newAdult, zero),
+                                     _mm_cmpeq_epi32(newCountdown, zero));
+    __m128i f = _mm_or_si128(_mm_set1_epi32(kAged), _mm_and_si128(dead, _mm_set1_epi32(kDead)));
+    f = _mm_or_si128(f, _mm_and_si128(_mm_andnot_si128(dead, dying), _mm_set1_epi32(kDying)));
+    f = _mm_or_si128(f, _mm_and_si128(_mm_andnot_si128(dead, ready), _mm_set1_epi32(kReady)));
+
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(&p.age[i]), newAge);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(&p.hunger[i]), newHunger);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(&p.reproduceCountdown[i]), newCountdown);
+    __m128i packed = _mm_packus_epi16(_mm_packs_epi32(newSpeed, newAdult),
+                                      _mm_packs_epi32(f, zero));
+    int32_t out[4];
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out), packed);
+    std::memcpy(&p.speed[i], &out[0], 4);
+    std::memcpy(&p.adult[i], &out[1], 4);
+    std::memcpy(&p.flags[i], &out[2], 4);
   }
-};
+  ageScalar<A>(p, i, end);
+}
 
 /**
- * MoveAction: moves an object by (dx, dy) if the target is empty.
+ * AVX2 version of ageSse41(): eight records per step.
  */
-struct MoveAction : public Action {
-  int dx, dy;
+template <class A>
+__attribute__((target("avx2")))
+void ageAvx2(CreaturePool& p, size_t begin, size_t end) {
+  const __m256i one = _mm256_set1_epi32(1);
+  const __m256i two = _mm256_set1_epi32(2);
+  const __m256i three = _mm256_set1_epi32(3);
+  const __m256i zero = _mm256_setzero_si256();
+  const __m256i allOnes = _mm256_set1_epi32(-1);
+  const __m256i step = _mm256_set1_epi32(A::hungerStep);
+  const __m256i limit = _mm256_set1_epi32(A::hungerLimit);
+  const __m256i speed2At = _mm256_set1_epi32(A::speed2At);
+  const __m256i speed3At = _mm256_set1_epi32(A::speed3At);
+  const __m256i divisor = _mm256_set1_epi32(A::adultDivisor);
+  size_t i = begin;
+  for (; i + 8 <= end; i += 8) {
+    __m256i age = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(&p.age[i]));
+    __m256i maxAge = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(&p.maxAge[i]));
+    __m256i hunger = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(&p.hunger[i]));
+    __m256i countdown = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(&p.reproduceCountdown[i]));
+    __m256i speed = _mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(&p.speed[i])));
+    __m256i adult = _mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(&p.adult[i])));
 
-  MoveAction(std::shared_ptr<Object> obj, int dx, int dy)
-    : Action(obj), dx(dx), dy(dy) {}
+    __m256i dead = _mm256_or_si256(_mm256_cmpgt_epi32(age, maxAge), _mm256_cmpgt_epi32(hunger, limit));
+    __m256i live = _mm256_andnot_si256(dead, allOnes);
 
-private:
-  bool apply(std::vector<std::shared_ptr<Object>>& field, size_t rows, size_t cols) override {
-    size_t newX = (obj->x + dx + rows) % rows;
-    size_t newY = (obj->y + dy + cols) % cols;
-    size_t oldIdx = obj->x * cols + obj->y;
-    size_t newIdx = newX * cols + newY;
-
-    if (field[newIdx]->getSymbol() == "  ") {
-      auto tmp = field[newIdx];
-      field[newIdx] = field[oldIdx];
-      field[oldIdx] = tmp;
-      obj->x = newX;
-      obj->y = newY;
-      obj->movedThisTurn = true;
-      return true;
-    }
-    return false;
+    __m256i newAge = _mm256_sub_epi32(age, live);
+    __m256i newHunger = _mm256_add_epi32(hunger, _mm256_and_si256(live, step));
+    __m256i newAdult = _mm256_blendv_epi8(adult, one,
+        _mm256_cmpgt_epi32(_mm256_mullo_epi32(newAge, divisor), maxAge));
+    newAdult = _mm256_andnot_si256(_mm256_cmpgt_epi32(newAge, maxAge), newAdult);
+    __m256i newSpeed = _mm256_blendv_epi8(speed, two,
+        _mm256_and_si256(_mm256_cmpgt_epi32(newHunger, speed2At), _mm256_cmpeq_epi32(speed, one)));
+    newSpeed = _mm256_blendv_epi8(newSpeed, three,
+        _mm256_and_si256(_mm256_cmpgt_epi32(newHunger, speed3At), _mm256_cmpeq_epi32(newSpeed, two)));
+    __m256i newCountdown = _mm256_add_epi32(countdown,
+        _mm256_and_si256(_mm256_cmpgt_epi32(countdown, zero), allOnes));
+
+    newAdult = _mm256_blendv_epi8(newAdult, adult, dead);
+    newSpeed = _mm256_blendv_epi8(newSpeed, speed, dead);
+    newCountdown = _mm256_blendv_epi8(newCountdown, countdown, dead);
+
+    __m256i dying = _mm256_or_si256(_mm256_cmpgt_epi32(newAge, maxAge),
+                                    _mm256_cmpgt_epi32(newHunger, limit));
+    __m256i ready = _mm256_andnot_si256(_mm256_cmpeq_epi32(newAdult, zero),
+                                        _mm256_cmpeq_epi32(newCountdown, zero));
+    __m256i f = _mm256_or_si256(_mm256_set1_epi32(kAged),
+                                _mm256_and_si256(dead, _mm256_set1_epi32(kDead)));
+    f = _mm256_or_si256(f, _mm256_and_si256(_mm256_andnot_si256(dead, dying),
+                                            _mm256_set1_epi32(kDying)));
+    f = _mm256_or_si256(f, _mm256_and_si256(_mm256_andnot_si256(dead, ready),
+                                            _mm256_set1_epi32(kReady)));
+
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(&p.age[i]), newAge);
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(&p.hunger[i]), newHunger);
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(&p.reproduceCountdown[i]), newCountdown);
+    // Pack each 8 x 32-bit vector down to 8 bytes
+    const __m256i order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+    __m256i speedAdult = _mm256_packs_epi32(newSpeed, newAdult);
+    __m256i flagsZero = _mm256_packs_epi32(f, zero);
+    __m256i bytes = _mm256_permutevar8x32_epi32(_mm256_packus_epi16(speedAdult, flagsZero), order);
+    // bytes now holds speed[0..7], adult[0..7], flags[0..7] in 8-byte groups
+    int64_t out[4];
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(out), bytes);
+    std::memcpy(&p.speed[i], &out[0], 8);
+    std::memcpy(&p.adult[i], &out[1], 8);
+    std::memcpy(&p.flags[i], &out[2], 8);
   }
-};
+  ageScalar<A>(p, i, end);
+}
+
+#endif
 
 /**
- * EatAction: used by predators to eat adjacent prey and move into that cell.
+ * Widest aging kernel the CPU supports, picked once: 2 for AVX2, 1 for
+ * SSE4.1, 0 for the scalar loop.
  */
-struct EatAction : public Action {
-  int dx, dy;
+inline int agingKernelLevel() {
+  static const int level = []() -> int {
+#ifdef OCEAN_X86_KERNELS
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) return 2;
+    if (__builtin_cpu_supports("sse4.1")) return 1;
+#endif
+    return 0;
+  }();
+  return level;
+}
 
-  EatAction(std::shared_ptr<Object> obj, int dx, int dy)
-    : Action(obj), dx(dx), dy(dy) {}
+inline const char* agingKernelName() {
+  static const char* const names[] = {"scalar", "sse4.1", "avx2"};
+  return names[agingKernelLevel()];
+}
 
-private:
-  bool apply(std::vector<std::shared_ptr<Object>>& field, size_t rows, size_t cols) override {
-    size_t newX = (obj->x + dx + rows) % rows;
-    size_t newY = (obj->y + dy + cols) % cols;
-    size_t oldIdx = obj->x * cols + obj->y;
-    size_t newIdx = newX * cols + newY;
-
-    std::string sym = field[newIdx]->getSymbol();
-    // We treat Stone (S ) or Reef (R ) or "  " as non-edible
-    if (sym != "  " && sym != "S " && sym != "R ") {
-      field[newIdx] = std::make_shared<Empty>();
-      auto tmp = field[newIdx];
-      field[newIdx] = field[oldIdx];
-      field[oldIdx] = tmp;
-      obj->x = newX;
-      obj->y = newY;
-      obj->movedThisTurn = true;
-      return true;
-    }
-    return false;
-  }
-};
+/**
+ * The widest aging kernel for the species aging as A.
+ */
+template <class A>
+AgingKernel agingKernel() {
+#ifdef OCEAN_X86_KERNELS
+  if (agingKernelLevel() == 2) return &ageAvx2<A>;
+  if (agingKernelLevel() == 1) return &ageSse41<A>;
+#endif
+  return &ageScalar<A>;
+}
+
+/**
+ * Number of objects of each species, indexed by Species.
+ */
+typedef std::array<size_t, static_cast<size_t>(Species::Count)> SpeciesCounts;
 
 /**
- * StormAction: a new type of action that simulates a small storm event
- * clearing everything in a certain radius around the given center.
+ * What happened during one iteration, per species.
  */
-struct StormAction : public Action {
-  int centerX, centerY;
-  int radius;
+struct TickEvents {
+  // Newborn creatures, by species of the newborn
+  SpeciesCounts births;
+  // Deaths of old age or starvation
+  SpeciesCounts deaths;
+  // Successful hunts, by species of the hunter
+  SpeciesCounts kills;
+  // Objects eaten, by species of the victim
+  SpeciesCounts eaten;
+  // Objects wiped out by the storm
+  SpeciesCounts stormLosses;
+  // Stones that became reefs and reefs that became stones, by new species
+  SpeciesCounts transforms;
 
-  StormAction(std::shared_ptr<Object> obj, int cx, int cy, int r)
-    : Action(obj), centerX(cx), centerY(cy), radius(r) {}
+  TickEvents() { reset(); }
 
-private:
-  bool apply(std::vector<std::shared_ptr<Object>>& field, size_t rows, size_t cols) override {
-    // For demonstration: remove (turn into Empty) everything in a circle or square region
-    for (int dx = -radius; dx <= radius; ++dx) {
-      for (int dy = -radius; dy <= radius; ++dy) {
-        // Square or circular check
-        // Let's do a simple square for simplicity
-        int nx = (centerX + dx + rows) % rows;
-        int ny = (centerY + dy + cols) % cols;
-        size_t idx = nx * cols + ny;
-        field[idx] = std::make_shared<Empty>();
-      }
+  void reset() {
+    births.fill(0);
+    deaths.fill(0);
+    kills.fill(0);
+    eaten.fill(0);
+    stormLosses.fill(0);
+    transforms.fill(0);
+  }
+
+  void add(const TickEvents& o) {
+    for (size_t k = 0; k < births.size(); ++k) {
+      births[k] += o.births[k];
+      deaths[k] += o.deaths[k];
+      kills[k] += o.kills[k];
+      eaten[k] += o.eaten[k];
+      stormLosses[k] += o.stormLosses[k];
+      transforms[k] += o.transforms[k];
     }
-    return true;
   }
 };
 
 /**
- * ActionWrapper is a helper that allows us to store actions in a vector.
+ * Cells whose content changed during the current iteration, recorded by
+ * the mutations themselves as they happen, and the events behind them.
+ * Every thread writes to its own log; a cell is listed once, the first
+ * time it changes.
  */
-struct ActionWrapper {
-  std::shared_ptr<Action> action;
-  ActionWrapper(std::shared_ptr<Action> a) : action(a) {}
+struct ChangeLog {
+  std::vector<size_t> cells;
+  TickEvents events;
+  // Cells in the halo rows of a sharded run touched since the last
+  // exchange with the neighbours, possibly repeated
+  std::vector<size_t> halo;
+  // Cells whose creature changed its own record (fed, or reset its
+  // reproduction countdown) without the cell being logged, possibly
+  // repeated; only kept while a recording is made
+  std::vector<size_t> records;
 };
 
 /**
- * The Ocean class: manages the grid of objects and the main simulation loop.
+ * Complete state of one cell, record included, as sent between the
+ * processes of a sharded run.
  */
-class Ocean {
-public:
-  Ocean(size_t r, size_t c)
-    : rows(r), cols(c), iterationCount(0), noChangeCounter(0)
-  {
-    field.resize(rows * cols);
-    for (size_t i = 0; i < rows; ++i) {
-      for (size_t j = 0; j < cols; ++j) {
-        auto obj = randomObject();
-        obj->x = i;
-        obj->y = j;
-        field[i * cols + j] = obj;
-      }
-    }
-  }
+struct CellState {
+  uint64_t idx;
+  uint64_t dueTick;
+  int32_t age;
+  int32_t maxAge;
+  int32_t hunger;
+  int32_t reproduceCountdown;
+  int32_t turnsToTransform;
+  uint8_t kind;
+  uint8_t moved;
+  uint8_t speed;
+  uint8_t adult;
+  uint8_t flags;
+};
 
-  /**
-   * Main simulation loop:
-   *  - Clear the screen
-   *  - Print stats
-   *  - Display the ocean
-   *  - Let each object tick and perform actions
-   *  - Sometimes trigger a "storm" event at random
-   *  - Stop if no changes happen for a while or we exceed a large iteration count
-   */
-  void run() {
-    bool running = true;
-    while (running) {
-      clearScreen();
-      printStats();
-      std::cout << "\n";
-      display();
-
-      auto oldState = copyState();
-
-      for (size_t i = 0; i < rows; ++i) {
-        for (size_t j = 0; j < cols; ++j) {
-          size_t idx = i * cols + j;
-          auto& obj = field[idx];
-
-          // Replace dead object with Empty
-          if (!obj->isAlive()) {
-            field[idx] = std::make_shared<Empty>();
-            continue;
-          }
-          if (!obj->movedThisTurn) {
-            obj->tick();
-            auto actions = decideActions(obj);
-            for (auto& aw : actions) {
-              aw.action->operator()(field, rows, cols);
-            }
-          }
-        }
-      }
+/**
+ * Side length of a storage tile. One row of a tile is exactly one word of
+ * a bitplane.
+ */
+const size_t kStorageTileSide = 64;
+const size_t kStorageTileCells = kStorageTileSide * kStorageTileSide;
 
-      // Occasionally trigger a random storm
-      if ((rand() % 1000) < 3) { 
-        int cx = rand() % rows;
-        int cy = rand() % cols;
-        int rad = 1 + rand() % 3; 
-        // We'll attach StormAction to a dummy object
-        auto dummy = std::make_shared<Empty>();
-        auto storm = std::make_shared<StormAction>(dummy, cx, cy, rad);
-        storm->operator()(field, rows, cols);
-        std::cout << ">>> Storm occurred around (" << cx << ", " << cy 
-                  << ") with radius " << rad << "!\n";
-      }
+/**
+ * Ticks a storage tile has to stay empty before it is released.
+ */
+const uint32_t kTileIdleTicks = 8;
 
-      for (auto& o : field) {
-        o->movedThisTurn = false;
-      }
+/**
+ * Largest number of tiles indexed by a flat directory (8 MiB of pointers,
+ * a 65536 x 65536 ocean). Bigger oceans use a two-level directory.
+ */
+const size_t kFlatDirectoryTiles = size_t(1) << 20;
 
-      iterationCount++;
+/**
+ * A 64x64 block of cells. Each cell holds only a type tag and the slot of
+ * its record in the pool of that species; the records themselves live in
+ * per-species pools.
+ */
+struct StorageTile {
+  Species kind[kStorageTileCells];
+  uint32_t slot[kStorageTileCells];
+  uint8_t movedThisTurn[kStorageTileCells];
+  // Set while the cell is listed in a ChangeLog for this iteration
+  uint8_t changed[kStorageTileCells];
+  // Occupancy bitplane of every species, one word per tile row. Threads
+  // updating neighbouring scheduling tiles may share a word, hence the
+  // atomics.
+  std::atomic<uint64_t> planes[static_cast<size_t>(Species::Count)][kStorageTileSide];
+  // Number of non-empty cells
+  std::atomic<uint32_t> occupied;
+  // End-of-tick checks in a row that found the tile empty
+  uint32_t idleTicks;
+  // Tile index (row of tiles times tiles per row plus column) and position
+  // in CellStore::liveTiles
+  size_t key;
+  size_t livePos;
 
-      if (!isChanged(oldState, field)) {
-        noChangeCounter++;
-      } else {
-        noChangeCounter = 0;
+  explicit StorageTile(size_t key) : occupied(0), idleTicks(0), key(key), livePos(0) {
+    std::fill(kind, kind + kStorageTileCells, Species::Empty);
+    std::fill(slot, slot + kStorageTileCells, kNoSlot);
+    std::memset(movedThisTurn, 0, sizeof(movedThisTurn));
+    std::memset(changed, 0, sizeof(changed));
+    for (size_t k = 0; k < static_cast<size_t>(Species::Count); ++k) {
+      for (size_t r = 0; r < kStorageTileSide; ++r) {
+        planes[k][r].store(k == static_cast<size_t>(Species::Empty) ? ~uint64_t(0) : 0,
+                           std::memory_order_relaxed);
       }
+    }
+  }
+};
 
-      if (noChangeCounter > 150 || iterationCount > 5000) {
-        running = false;
-      }
+/**
+ * Storage for the ocean grid: a sparse set of 64x64 tiles. A tile is
+ * allocated the first time something is written into it and released
+ * after staying empty for kTileIdleTicks ticks; a missing tile reads as
+ * all Empty. Tiles are found through a flat directory, or for huge oceans
+ * a two-level one (blocks of 64x64 tiles allocated on first use), so
+ * memory scales with the occupied area. Cells are still addressed by
+ * their row-major index.
+ */
+struct CellStore {
+  CreaturePool pools[static_cast<size_t>(Species::Count)];
+  size_t rows = 0;
+  size_t cols = 0;
+  size_t tilesY = 0;
+  size_t blocksY = 0;
+  // Tile pointers by tile index, when the ocean is small enough
+  std::unique_ptr<std::atomic<StorageTile*>[]> flatTiles;
+  // Otherwise directory blocks, each 64x64 tile pointers, allocated on
+  // first use
+  std::unique_ptr<std::atomic<std::atomic<StorageTile*>*>[]> blocks;
+  size_t blockCount = 0;
+  // Allocated tiles, in no particular order
+  std::vector<StorageTile*> liveTiles;
+  // Guards tile and block allocation while tiles are updated in parallel
+  std::mutex tileMutex;
+  // In a sharded run, for every row, the neighbour that has to hear about
+  // changes to it (1 above, 2 below, 0 none); empty otherwise
+  std::vector<uint8_t> haloRows;
 
-      sleepMs(120);
-    }
+  CellStore() {}
+  CellStore(const CellStore&) = delete;
+  CellStore& operator=(const CellStore&) = delete;
 
-    // Final display
-    clearScreen();
-    printStats();
-    std::cout << "\n";
-    display();
-    std::cout << "\nSimulation ended. Press Enter to exit.\n";
-    std::cin.get();
+  ~CellStore() {
+    for (StorageTile* t : liveTiles) {
+      delete t;
+    }
+    for (size_t b = 0; b < blockCount; ++b) {
+      delete[] blocks[b].load(std::memory_order_relaxed);
+    }
   }
 
-private:
+  void resize(size_t r, size_t c) {
+    rows = r;
+    cols = c;
+    size_t tilesX = (rows + kStorageTileSide - 1) / kStorageTileSide;
+    tilesY = (cols + kStorageTileSide - 1) / kStorageTileSide;
+    if (tilesX * tilesY <= kFlatDirectoryTiles) {
+      flatTiles.reset(new std::atomic<StorageTile*>[tilesX * tilesY]);
+      for (size_t t = 0; t < tilesX * tilesY; ++t) {
+        flatTiles[t].store(nullptr, std::memory_order_relaxed);
+      }
+      return;
+    }
+    blocksY = (tilesY + kStorageTileSide - 1) / kStorageTileSide;
+    blockCount = ((tilesX + kStorageTileSide - 1) / kStorageTileSide) * blocksY;
+    blocks.reset(new std::atomic<std::atomic<StorageTile*>*>[blockCount]);
+    for (size_t b = 0; b < blockCount; ++b) {
+      blocks[b].store(nullptr, std::memory_order_relaxed);
+    }
+  }
+
+  size_t size() const { return rows * cols; }
+
+  CreaturePool& pool(Species k) { return pools[static_cast<size_t>(k)]; }
+  const CreaturePool& pool(Species k) const { return pools[static_cast<size_t>(k)]; }
+
+  /**
+   * Directory entry of the tile holding (x, y), or null if its block of
+   * the directory does not exist yet.
+   */
+  std::atomic<StorageTile*>* entry(size_t x, size_t y) const {
+    size_t tx = x / kStorageTileSide;
+    size_t ty = y / kStorageTileSide;
+    if (flatTiles) return &flatTiles[tx * tilesY + ty];
+    std::atomic<StorageTile*>* block =
+        blocks[(tx / kStorageTileSide) * blocksY + ty / kStorageTileSide].load(
+            std::memory_order_acquire);
+    if (!block) return nullptr;
+    return &block[(tx % kStorageTileSide) * kStorageTileSide + ty % kStorageTileSide];
+  }
+
+  /**
+   * Tile holding (x, y), or null if it is not allocated.
+   */
+  StorageTile* tileAt(size_t x, size_t y) const {
+    std::atomic<StorageTile*>* e = entry(x, y);
+    return e ? e->load(std::memory_order_acquire) : nullptr;
+  }
+
+  /**
+   * Tile holding (x, y), allocating it if needed.
+   */
+  StorageTile& ensureTile(size_t x, size_t y) {
+    StorageTile* t = tileAt(x, y);
+    if (t) return *t;
+    std::lock_guard<std::mutex> lock(tileMutex);
+    size_t tx = x / kStorageTileSide;
+    size_t ty = y / kStorageTileSide;
+    std::atomic<std::atomic<StorageTile*>*>* block =
+        flatTiles ? nullptr : &blocks[(tx / kStorageTileSide) * blocksY + ty / kStorageTileSide];
+    if (block && !block->load(std::memory_order_relaxed)) {
+      std::atomic<StorageTile*>* fresh = new std::atomic<StorageTile*>[kStorageTileCells];
+      for (size_t i = 0; i < kStorageTileCells; ++i) {
+        fresh[i].store(nullptr, std::memory_order_relaxed);
+      }
+      block->store(fresh, std::memory_order_release);
+    }
+    std::atomic<StorageTile*>* e = entry(x, y);
+    t = e->load(std::memory_order_relaxed);
+    if (!t) {
+      t = new StorageTile(tx * tilesY + ty);
+      t->livePos = liveTiles.size();
+      liveTiles.push_back(t);
+      e->store(t, std::memory_order_release);
+    }
+    return *t;
+  }
+
+  static size_t offsetOf(size_t x, size_t y) {
+    return (x % kStorageTileSide) * kStorageTileSide + y % kStorageTileSide;
+  }
+
+  Species kindAt(size_t x, size_t y) const {
+    const StorageTile* t = tileAt(x, y);
+    return t ? t->kind[offsetOf(x, y)] : Species::Empty;
+  }
+
+  Species kindAt(size_t idx) const { return kindAt(idx / cols, idx % cols); }
+
+  /**
+   * Allocated tile holding a cell and the cell's offset in it.
+   */
+  struct CellRef {
+    StorageTile* tile;
+    size_t offset;
+  };
+
+  /**
+   * Finds a cell that is known to lie in an allocated tile.
+   */
+  CellRef locate(size_t idx) const {
+    size_t x = idx / cols, y = idx % cols;
+    CellRef ref = {tileAt(x, y), offsetOf(x, y)};
+    return ref;
+  }
+
+  uint32_t slotAt(size_t idx) const {
+    size_t x = idx / cols, y = idx % cols;
+    const StorageTile* t = tileAt(x, y);
+    return t ? t->slot[offsetOf(x, y)] : kNoSlot;
+  }
+
+  /**
+   * Changes the species tag of a cell in an allocated tile, keeping the
+   * bitplanes and the occupancy count in step.
+   */
+  void setKind(StorageTile& t, size_t x, size_t y, Species k) {
+    size_t o = offsetOf(x, y);
+    Species old = t.kind[o];
+    if (old == k) return;
+    uint64_t bit = uint64_t(1) << (y % kStorageTileSide);
+    size_t row = x % kStorageTileSide;
+    t.planes[static_cast<size_t>(old)][row].fetch_and(~bit, std::memory_order_relaxed);
+    t.planes[static_cast<size_t>(k)][row].fetch_or(bit, std::memory_order_relaxed);
+    if (old == Species::Empty) {
+      t.occupied.fetch_add(1, std::memory_order_relaxed);
+    } else if (k == Species::Empty) {
+      t.occupied.fetch_sub(1, std::memory_order_relaxed);
+    }
+    t.kind[o] = k;
+  }
+
+  /**
+   * Cells of row x of a tile (null if not allocated) that hold one of the
+   * species in `species` (bit k set for species k).
+   */
+  static uint64_t planeWord(const StorageTile* t, unsigned species, size_t x) {
+    if (!t) return species & (1u << static_cast<unsigned>(Species::Empty)) ? ~uint64_t(0) : 0;
+    uint64_t bits = 0;
+    for (unsigned k = 0; k < static_cast<unsigned>(Species::Count); ++k) {
+      if (species & (1u << k)) {
+        bits |= t->planes[k][x % kStorageTileSide].load(std::memory_order_relaxed);
+      }
+    }
+    return bits;
+  }
+
+  /**
+   * Adds to counts the number of cells of each non-empty species in the
+   * h x w block at (x0, y0), which must not cross the grid's edges. Works
+   * on whole plane words, so an allocated tile costs a few popcounts per
+   * row and an absent one nothing.
+   */
+  void countBlock(size_t x0, size_t y0, size_t h, size_t w,
+                  std::array<size_t, static_cast<size_t>(Species::Count)>& counts) const {
+    for (size_t tx = x0 / kStorageTileSide; tx * kStorageTileSide < x0 + h; ++tx) {
+      size_t r0 = std::max(x0, tx * kStorageTileSide);
+      size_t r1 = std::min(x0 + h, (tx + 1) * kStorageTileSide);
+      for (size_t ty = y0 / kStorageTileSide; ty * kStorageTileSide < y0 + w; ++ty) {
+        const StorageTile* t = tileAt(tx * kStorageTileSide, ty * kStorageTileSide);
+        if (!t) continue;
+        size_t c0 = std::max(y0, ty * kStorageTileSide) - ty * kStorageTileSide;
+        size_t c1 = std::min(y0 + w, (ty + 1) * kStorageTileSide) - ty * kStorageTileSide;
+        uint64_t mask = (c1 - c0 == 64 ? ~uint64_t(0) : ((uint64_t(1) << (c1 - c0)) - 1)) << c0;
+        for (size_t k = 1; k < static_cast<size_t>(Species::Count); ++k) {
+          size_t n = 0;
+          for (size_t x = r0; x < r1; ++x) {
+            n += popCount(t->planes[k][x % kStorageTileSide].load(std::memory_order_relaxed) & mask);
+          }
+          counts[k] += n;
+        }
+      }
+    }
+  }
+
+  /**
+   * Reads the same `width` (at most 64) columns, starting at y0, from
+   * several rows, looking the tiles up again only when a row lies in
+   * another band of tiles. The columns must not wrap around the row.
+   */
+  class WindowReader {
+  public:
+    WindowReader(const CellStore& store, unsigned species, size_t y0, int width)
+      : store(store), species(species), y0(y0), width(width), band(kNoBand) {}
+
+    /**
+     * Cells of the columns in row x that hold one of the species; bit i
+     * stands for column y0 + i.
+     */
+    uint64_t read(size_t x) {
+      size_t offset = y0 % 64;
+      if (x / kStorageTileSide != band) {
+        band = x / kStorageTileSide;
+        left = store.tileAt(x, y0);
+        right = offset + width > 64 ? store.tileAt(x, y0 + width - 1) : nullptr;
+      }
+      uint64_t bits = planeWord(left, species, x) >> offset;
+      if (offset + width > 64) {
+        bits |= planeWord(right, species, x) << (64 - offset);
+      }
+      return width == 64 ? bits : bits & ((uint64_t(1) << width) - 1);
+    }
+
+  private:
+    static const size_t kNoBand = size_t(-1);
+    const CellStore& store;
+    unsigned species;
+    size_t y0;
+    int width;
+    size_t band;
+    const StorageTile* left = nullptr;
+    const StorageTile* right = nullptr;
+  };
+
+  /**
+   * Records that a cell, at offset o of tile t, is about to change.
+   */
+  void touch(StorageTile& t, size_t o, size_t idx, ChangeLog& log) {
+    if (!haloRows.empty() && haloRows[idx / cols]) {
+      log.halo.push_back(idx);
+    }
+    if (!t.changed[o]) {
+      t.changed[o] = 1;
+      log.cells.push_back(idx);
+    }
+  }
+
+  /**
+   * Turns the cell into an Empty one, returning its record to the pool.
+   */
+  void clear(size_t idx, ChangeLog& log) {
+    size_t x = idx / cols, y = idx % cols;
+    StorageTile* t = tileAt(x, y);
+    if (t) clear(*t, x, y, idx, log);
+  }
+
+  void clear(StorageTile& t, size_t x, size_t y, size_t idx, ChangeLog& log) {
+    size_t o = offsetOf(x, y);
+    if (t.kind[o] == Species::Empty) return;
+    touch(t, o, idx, log);
+    pool(t.kind[o]).release(t.slot[o]);
+    setKind(t, x, y, Species::Empty);
+    t.slot[o] = kNoSlot;
+    t.movedThisTurn[o] = 0;
+  }
+
+  /**
+   * Replaces the cell's content with a fresh, zeroed record of species k
+   * and returns its slot.
+   */
+  uint32_t place(size_t idx, Species k, ChangeLog& log) {
+    size_t x = idx / cols, y = idx % cols;
+    StorageTile& t = ensureTile(x, y);
+    size_t o = offsetOf(x, y);
+    clear(t, x, y, idx, log);
+    touch(t, o, idx, log);
+    setKind(t, x, y, k);
+    t.slot[o] = pool(k).allocate();
+    pool(k).cell[t.slot[o]] = idx;
+    return t.slot[o];
+  }
+
+  /**
+   * Moves the content of cell a into the empty cell b, which may lie in
+   * another tile, and marks it as moved this turn.
+   */
+  void moveCell(size_t a, size_t b, ChangeLog& log) {
+    size_t xa = a / cols, ya = a % cols, xb = b / cols, yb = b % cols;
+    StorageTile& ta = *tileAt(xa, ya);
+    StorageTile& tb = ensureTile(xb, yb);
+    size_t oa = offsetOf(xa, ya), ob = offsetOf(xb, yb);
+    touch(ta, oa, a, log);
+    touch(tb, ob, b, log);
+    Species k = ta.kind[oa];
+    setKind(ta, xa, ya, Species::Empty);
+    setKind(tb, xb, yb, k);
+    tb.slot[ob] = ta.slot[oa];
+    ta.slot[oa] = kNoSlot;
+    ta.movedThisTurn[oa] = 0;
+    tb.movedThisTurn[ob] = 1;
+    pool(k).cell[tb.slot[ob]] = b;
+  }
+
+  /**
+   * Full state of a cell.
+   */
+  CellState save(size_t idx) const {
+    CellState s = CellState();
+    s.idx = idx;
+    Species k = kindAt(idx);
+    s.kind = static_cast<uint8_t>(k);
+    if (k == Species::Empty) return s;
+    CellRef c = locate(idx);
+    const CreaturePool& p = pool(k);
+    uint32_t i = c.tile->slot[c.offset];
+    s.dueTick = p.dueTick[i];
+    s.age = p.age[i];
+    s.maxAge = p.maxAge[i];
+    s.hunger = p.hunger[i];
+    s.reproduceCountdown = p.reproduceCountdown[i];
+    s.turnsToTransform = p.turnsToTransform[i];
+    s.moved = c.tile->movedThisTurn[c.offset];
+    s.speed = p.speed[i];
+    s.adult = p.adult[i];
+    s.flags = p.flags[i];
+    return s;
+  }
+
+  /**
+   * Overwrites a cell with a saved state. May grow the pools, so it must
+   * not run while tiles are updated in parallel.
+   */
+  void load(const CellState& s, ChangeLog& log) {
+    Species k = static_cast<Species>(s.kind);
+    if (k == Species::Empty) {
+      clear(s.idx, log);
+      return;
+    }
+    uint32_t i;
+    if (kindAt(s.idx) == k) {
+      // Same species: overwrite the record in place
+      CellRef c = locate(s.idx);
+      touch(*c.tile, c.offset, s.idx, log);
+      i = c.tile->slot[c.offset];
+    } else {
+      i = place(s.idx, k, log);
+    }
+    CreaturePool& p = pool(k);
+    p.dueTick[i] = s.dueTick;
+    p.age[i] = s.age;
+    p.maxAge[i] = s.maxAge;
+    p.hunger[i] = s.hunger;
+    p.reproduceCountdown[i] = s.reproduceCountdown;
+    p.turnsToTransform[i] = s.turnsToTransform;
+    p.speed[i] = s.speed;
+    p.adult[i] = s.adult;
+    p.flags[i] = s.flags;
+    CellRef c = locate(s.idx);
+    c.tile->movedThisTurn[c.offset] = s.moved;
+  }
+
+  /**
+   * Ends the iteration for the cells in a log: clears their change marks
+   * and the moved flags, which can only be set on changed cells.
+   */
+  void settle(const ChangeLog& log) {
+    for (size_t idx : log.cells) {
+      size_t x = idx / cols, y = idx % cols;
+      StorageTile* t = tileAt(x, y);
+      t->changed[offsetOf(x, y)] = 0;
+      t->movedThisTurn[offsetOf(x, y)] = 0;
+    }
+  }
+
+  /**
+   * Releases the tiles that have been empty for kTileIdleTicks checks in a
+   * row. Called once per tick, between iterations.
+   */
+  void releaseIdleTiles() {
+    for (size_t i = 0; i < liveTiles.size();) {
+      StorageTile* t = liveTiles[i];
+      if (t->occupied.load(std::memory_order_relaxed) != 0) {
+        t->idleTicks = 0;
+      } else if (++t->idleTicks >= kTileIdleTicks) {
+        size_t tx = t->key / tilesY, ty = t->key % tilesY;
+        entry(tx * kStorageTileSide, ty * kStorageTileSide)->store(nullptr, std::memory_order_relaxed);
+        liveTiles[i] = liveTiles.back();
+        liveTiles[i]->livePos = i;
+        liveTiles.pop_back();
+        delete t;
+        continue;
+      }
+      ++i;
+    }
+  }
+
+  /**
+   * Allocated tiles ordered by key, so that walks over the grid do not
+   * depend on the order in which tiles were allocated.
+   */
+  std::vector<const StorageTile*> sortedTiles() const {
+    std::vector<const StorageTile*> tiles(liveTiles.begin(), liveTiles.end());
+    std::sort(tiles.begin(), tiles.end(),
+              [](const StorageTile* a, const StorageTile* b) { return a->key < b->key; });
+    return tiles;
+  }
+
+  /**
+   * Grid memory used by one cell of an allocated tile, not counting pool
+   * records.
+   */
+  static double bytesPerCell() {
+    return static_cast<double>(sizeof(StorageTile)) / kStorageTileCells;
+  }
+
+  /**
+   * Memory held by the allocated tiles and the tile directory.
+   */
+  size_t tileBytes() const {
+    size_t bytes = liveTiles.size() * sizeof(StorageTile) +
+                   blockCount * sizeof(std::atomic<std::atomic<StorageTile*>*>);
+    if (flatTiles) {
+      bytes += (rows + kStorageTileSide - 1) / kStorageTileSide * tilesY *
+               sizeof(std::atomic<StorageTile*>);
+    }
+    for (size_t b = 0; b < blockCount; ++b) {
+      if (blocks[b].load(std::memory_order_relaxed)) {
+        bytes += kStorageTileCells * sizeof(std::atomic<StorageTile*>);
+      }
+    }
+    return bytes;
+  }
+
+  /**
+   * Memory held by all pools, including free slots.
+   */
+  size_t poolBytes() const {
+    size_t records = 0;
+    for (const CreaturePool& p : pools) {
+      records += p.capacity();
+    }
+    return records * CreaturePool::bytesPerRecord();
+  }
+};
+
+/**
+ * Ready-made rule sets, as stored in checkpoints and recordings.
+ */
+enum class RuleSet : uint32_t {
+  Classic,
+  Harsh,
+  Lush,
+  Count
+};
+
+static const char* const kRuleSetNames[] = {"classic", "harsh", "lush"};
+
+static_assert(sizeof(kRuleSetNames) / sizeof(kRuleSetNames[0]) ==
+              static_cast<size_t>(RuleSet::Count),
+              "kRuleSetNames must name every rule set");
+
+inline const char* ruleSetName(RuleSet r) {
+  return kRuleSetNames[static_cast<size_t>(r)];
+}
+
+/**
+ * Lifespans, hunger limits, reproduction intervals and transformation
+ * times of every species. The engine is a template over the rule set, so
+ * all of them are compile-time constants where they are used. Every other
+ * rule set derives from this one and overrides what it changes. Ranges
+ * such as `maxAge + [0, maxAgeSpread)` are drawn per object.
+ */
+struct ClassicRules {
+  static constexpr RuleSet id = RuleSet::Classic;
+
+  // Countdown to turning into a Reef: turns + [0, turnsSpread)
+  struct Stone {
+    static constexpr int turns = 150;
+    static constexpr int turnsSpread = 50;
+  };
+
+  // Countdown to turning back into Stone
+  struct Reef {
+    static constexpr int turns = 300;
+    static constexpr int turnsSpread = 50;
+  };
+
+  // Aging of a creature without hunger, see ageRecord()
+  struct Creature {
+    static constexpr int32_t hungerStep = 0;
+    static constexpr int32_t hungerLimit = INT_MAX;
+    static constexpr int32_t speed2At = INT_MAX;
+    static constexpr int32_t speed3At = INT_MAX;
+  };
+
+  // Lifespan maxAge + [0, maxAgeSpread), adult past maxAge / adultDivisor,
+  // ticks between births reproduceEvery + [0, reproduceSpread)
+  struct Prey : Creature {
+    static constexpr int maxAge = 800;
+    static constexpr int maxAgeSpread = 200;
+    static constexpr int32_t adultDivisor = 3;
+    static constexpr int reproduceEvery = 80;
+    static constexpr int reproduceSpread = 20;
+  };
+
+  // Roams faster above hungryAbove, and only breeds below it
+  struct Predator : Creature {
+    static constexpr int maxAge = 1000;
+    static constexpr int maxAgeSpread = 200;
+    static constexpr int32_t adultDivisor = 3;
+    static constexpr int reproduceEvery = 120;
+    static constexpr int reproduceSpread = 30;
+    static constexpr int32_t hungerStep = 1;
+    static constexpr int32_t hungerLimit = 50;
+    static constexpr int32_t hungryAbove = 10;
+  };
+
+  // Speeds up when starving; at speed 3 it also hunts predators
+  struct ApexPredator : Creature {
+    static constexpr int maxAge = 1200;
+    static constexpr int maxAgeSpread = 300;
+    static constexpr int32_t adultDivisor = 4;
+    static constexpr int reproduceEvery = 200;
+    static constexpr int reproduceSpread = 50;
+    static constexpr int32_t hungerStep = 1;
+    static constexpr int32_t hungerLimit = 60;
+    static constexpr int32_t hungryAbove = 10;
+    static constexpr int32_t speed2At = 15;
+    static constexpr int32_t speed3At = 35;
+  };
+};
+
+/**
+ * Scarce food: predators starve sooner and prey lives shorter and breeds
+ * more slowly.
+ */
+struct HarshRules : ClassicRules {
+  static constexpr RuleSet id = RuleSet::Harsh;
+
+  struct Prey : ClassicRules::Prey {
+    static constexpr int maxAge = 600;
+    static constexpr int reproduceEvery = 100;
+  };
+
+  struct Predator : ClassicRules::Predator {
+    static constexpr int32_t hungerLimit = 40;
+  };
+
+  struct ApexPredator : ClassicRules::ApexPredator {
+    static constexpr int32_t hungerLimit = 45;
+    static constexpr int32_t speed2At = 10;
+    static constexpr int32_t speed3At = 25;
+  };
+};
+
+/**
+ * Plenty of food: prey breeds twice as fast and predators go longer
+ * without eating.
+ */
+struct LushRules : ClassicRules {
+  static constexpr RuleSet id = RuleSet::Lush;
+
+  struct Prey : ClassicRules::Prey {
+    static constexpr int reproduceEvery = 40;
+  };
+
+  struct Predator : ClassicRules::Predator {
+    static constexpr int32_t hungerLimit = 70;
+  };
+
+  struct ApexPredator : ClassicRules::ApexPredator {
+    static constexpr int32_t hungerLimit = 80;
+  };
+};
+
+/**
+ * Represents an empty cell. We'll display it as "  " (two spaces).
+ * Empty cells have no pool record.
+ */
+struct Empty {
+  static void spawn(CellStore& s, size_t idx, CellRng&, ChangeLog& log) {
+    s.clear(idx, log);
+  }
+};
+
+/**
+ * Stone (S). Eventually transforms into a Reef (R).
+ */
+template <class Rules>
+struct Stone {
+  static void spawn(CellStore& s, size_t idx, CellRng& rng, ChangeLog& log) {
+    uint32_t i = s.place(idx, Species::Stone, log);
+    s.pool(Species::Stone).turnsToTransform[i] =
+        Rules::Stone::turns + rng.below(Rules::Stone::turnsSpread);
+  }
+};
+
+/**
+ * Reef (R). Transforms back into Stone (S).
+ */
+template <class Rules>
+struct Reef {
+  static void spawn(CellStore& s, size_t idx, CellRng& rng, ChangeLog& log) {
+    uint32_t i = s.place(idx, Species::Reef, log);
+    s.pool(Species::Reef).turnsToTransform[i] =
+        Rules::Reef::turns + rng.below(Rules::Reef::turnsSpread);
+  }
+};
+
+/**
+ * A Stone or Reef is updated once per tick from the tick after it
+ * appeared (tick 0 for the initial ocean), and every update takes two off
+ * its countdown: once when it ticks and once when it decides. It
+ * transforms on the update that brings the countdown to zero.
+ */
+inline uint64_t terrainUpdates(int32_t turns) {
+  return turns <= 2 ? 1 : static_cast<uint64_t>(turns + 1) / 2;
+}
+
+/**
+ * Prey (~). Flees from predators and can reproduce.
+ */
+template <class Rules>
+struct Prey {
+  typedef typename Rules::Prey R;
+
+  static void spawn(CellStore& s, size_t idx, CellRng& rng, ChangeLog& log) {
+    uint32_t i = s.place(idx, Species::Prey, log);
+    CreaturePool& p = s.pool(Species::Prey);
+    p.maxAge[i] = R::maxAge + rng.below(R::maxAgeSpread);
+    p.reproduceCountdown[i] = R::reproduceEvery + rng.below(R::reproduceSpread);
+  }
+
+  static bool canReproduce(const CreaturePool& p, uint32_t i) {
+    return (p.flags[i] & kReady) != 0;
+  }
+
+  static void resetReproduce(CreaturePool& p, uint32_t i, CellRng& rng) {
+    p.reproduceCountdown[i] = R::reproduceEvery + rng.below(R::reproduceSpread);
+  }
+};
+
+/**
+ * Predator (P). Hunts Prey (~). Avoids Apex (A). Has hunger; dies if too hungry.
+ */
+template <class Rules>
+struct Predator {
+  typedef typename Rules::Predator R;
+
+  static void spawn(CellStore& s, size_t idx, CellRng& rng, ChangeLog& log) {
+    uint32_t i = s.place(idx, Species::Predator, log);
+    CreaturePool& p = s.pool(Species::Predator);
+    p.maxAge[i] = R::maxAge + rng.below(R::maxAgeSpread);
+    p.reproduceCountdown[i] = R::reproduceEvery + rng.below(R::reproduceSpread);
+  }
+
+  static bool isHungry(const CreaturePool& p, uint32_t i) {
+    return (p.hunger[i] > R::hungryAbove);
+  }
+
+  static void feed(CreaturePool& p, uint32_t i) {
+    p.hunger[i] = 0;
+  }
+
+  static bool canReproduce(const CreaturePool& p, uint32_t i) {
+    return (p.flags[i] & kReady) && !isHungry(p, i);
+  }
+
+  static void resetReproduce(CreaturePool& p, uint32_t i, CellRng& rng) {
+    p.reproduceCountdown[i] = R::reproduceEvery + rng.below(R::reproduceSpread);
+  }
+};
+
+/**
+ * Apex predator (A). Can eat both Prey and Predator if hungry enough.
+ */
+template <class Rules>
+struct ApexPredator {
+  typedef typename Rules::ApexPredator R;
+
+  static void spawn(CellStore& s, size_t idx, CellRng& rng, ChangeLog& log) {
+    uint32_t i = s.place(idx, Species::ApexPredator, log);
+    CreaturePool& p = s.pool(Species::ApexPredator);
+    p.maxAge[i] = R::maxAge + rng.below(R::maxAgeSpread);
+    p.speed[i] = 1;
+    p.reproduceCountdown[i] = R::reproduceEvery + rng.below(R::reproduceSpread);
+  }
+
+  static bool canEatPredator(const CreaturePool& p, uint32_t i) {
+    return (p.speed[i] == 3);
+  }
+
+  static bool isHungry(const CreaturePool& p, uint32_t i) {
+    return (p.hunger[i] > R::hungryAbove);
+  }
+
+  static void feed(CreaturePool& p, uint32_t i) {
+    p.hunger[i] = 0;
+    p.speed[i] = 1;
+  }
+
+  static bool canReproduce(const CreaturePool& p, uint32_t i) {
+    return (p.flags[i] & kReady) && !isHungry(p, i);
+  }
+
+  static void resetReproduce(CreaturePool& p, uint32_t i, CellRng& rng) {
+    p.reproduceCountdown[i] = R::reproduceEvery + rng.below(R::reproduceSpread);
+  }
+};
+
+/**
+ * Fills a cell with a new object of species k under a rule set.
+ */
+template <class Rules>
+void spawn(Species k, CellStore& s, size_t idx, CellRng& rng, ChangeLog& log) {
+  switch (k) {
+    case Species::Empty:        Empty::spawn(s, idx, rng, log); break;
+    case Species::Stone:        Stone<Rules>::spawn(s, idx, rng, log); break;
+    case Species::Reef:         Reef<Rules>::spawn(s, idx, rng, log); break;
+    case Species::Prey:         Prey<Rules>::spawn(s, idx, rng, log); break;
+    case Species::Predator:     Predator<Rules>::spawn(s, idx, rng, log); break;
+    case Species::ApexPredator: ApexPredator<Rules>::spawn(s, idx, rng, log); break;
+    default: break;
+  }
+}
+
+/**
+ * Static description of a species, indexed by its Species tag.
+ * The symbol is only needed when rendering; the simulation itself
+ * dispatches on the tag through this table.
+ */
+struct SpeciesInfo {
+  const char* symbol;
+  const char* name;
+  // Whether a predator can eat an object of this species
+  bool edible;
+};
+
+static const SpeciesInfo kSpeciesInfo[] = {
+  {"  ", "Empty",        false},
+  {"S ", "Stone",        false},
+  {"R ", "Reef",         false},
+  {"~ ", "Prey",         true},
+  {"P ", "Predator",     true},
+  {"A ", "ApexPredator", true},
+};
+
+static_assert(sizeof(kSpeciesInfo) / sizeof(kSpeciesInfo[0]) ==
+              static_cast<size_t>(Species::Count),
+              "kSpeciesInfo must describe every species");
+
+inline const SpeciesInfo& infoOf(Species k) {
+  return kSpeciesInfo[static_cast<size_t>(k)];
+}
+
+/**
+ * Initial distribution of species, in percent per cell, indexed by Species.
+ */
+struct SpeciesMix {
+  const char* name;
+  int percent[static_cast<size_t>(Species::Count)];
+};
+
+static const SpeciesMix kDefaultMix   = {"default",     {40, 10, 10, 20, 15,  5}};
+static const SpeciesMix kPreyHeavyMix = {"prey-heavy",  {30,  5,  5, 50,  8,  2}};
+static const SpeciesMix kApexHeavyMix = {"apex-heavy",  {40, 10, 10, 20,  5, 15}};
+
+/**
+ * Snapshot of the ocean statistics after an iteration.
+ */
+struct OceanStats {
+  size_t iteration;
+  size_t noChangeCounter;
+  size_t changedCells;
+  size_t liveTiles;
+  SpeciesCounts population;
+  TickEvents lastTick;
+};
+
+/**
+ * Where the last storm hit, if one occurred during the last iteration.
+ */
+struct StormEvent {
+  bool occurred = false;
+  size_t x = 0;
+  size_t y = 0;
+  int radius = 0;
+};
+
+/**
+ * Action record used by objects to modify the ocean state.
+ * Actions are plain values: an object writes the ones it decides on into a
+ * reusable buffer and the ocean applies them right away, so deciding and
+ * applying never touch the heap.
+ */
+struct Action {
+  enum Type : uint8_t {
+    // Moves the object by (dx, dy) if the target is empty
+    Move,
+    // Used by predators to eat the object at (dx, dy) and move into that cell
+    Eat,
+    // Simulates a small storm clearing everything within a radius of the cell
+    Storm
+  };
+
+  Type type;
+  int dx, dy;
+  // Cell of the acting object, or the centre of a storm
+  size_t idx;
+
+  static Action move(size_t idx, int dx, int dy) {
+    Action a = {Move, dx, dy, idx};
+    return a;
+  }
+
+  static Action eat(size_t idx, int dx, int dy) {
+    Action a = {Eat, dx, dy, idx};
+    return a;
+  }
+
+  static Action storm(size_t centerIdx, int radius) {
+    Action a = {Storm, radius, radius, centerIdx};
+    return a;
+  }
+
+  bool operator()(CellStore& field, size_t rows, size_t cols, ChangeLog& log) const {
+    switch (type) {
+      case Move:  return applyMove(field, rows, cols, log);
+      case Eat:   return applyEat(field, rows, cols, log);
+      case Storm: return applyStorm(field, rows, cols, log);
+    }
+    return false;
+  }
+
+private:
+  size_t target(size_t rows, size_t cols) const {
+    size_t newX = wrap(static_cast<long long>(idx / cols) + dx, rows);
+    size_t newY = wrap(static_cast<long long>(idx % cols) + dy, cols);
+    return newX * cols + newY;
+  }
+
+  bool applyMove(CellStore& field, size_t rows, size_t cols, ChangeLog& log) const {
+    size_t newIdx = target(rows, cols);
+    if (field.kindAt(newIdx) == Species::Empty) {
+      field.moveCell(idx, newIdx, log);
+      return true;
+    }
+    return false;
+  }
+
+  bool applyEat(CellStore& field, size_t rows, size_t cols, ChangeLog& log) const {
+    size_t newIdx = target(rows, cols);
+    if (infoOf(field.kindAt(newIdx)).edible) {
+      log.events.kills[static_cast<size_t>(field.kindAt(idx))]++;
+      log.events.eaten[static_cast<size_t>(field.kindAt(newIdx))]++;
+      field.clear(newIdx, log);
+      field.moveCell(idx, newIdx, log);
+      return true;
+    }
+    return false;
+  }
+
+  bool applyStorm(CellStore& field, size_t rows, size_t cols, ChangeLog& log) const {
+    long long centerX = static_cast<long long>(idx / cols);
+    long long centerY = static_cast<long long>(idx % cols);
+    int radius = dx;
+    // For demonstration: remove (turn into Empty) everything in a square region
+    for (int i = -radius; i <= radius; ++i) {
+      for (int j = -radius; j <= radius; ++j) {
+        size_t nx = wrap(centerX + i, rows);
+        size_t ny = wrap(centerY + j, cols);
+        log.events.stormLosses[static_cast<size_t>(field.kindAt(nx, ny))]++;
+        field.clear(nx * cols + ny, log);
+      }
+    }
+    return true;
+  }
+};
+
+/**
+ * Per-thread buffers reused by every decision, so that the decide/apply
+ * phase makes no heap allocations once they have grown to size.
+ */
+struct WorkerScratch {
+  std::vector<Action> actions;
+  ChangeLog log;
+  // Cells of the current tile that gained a creature ahead of the sweep
+  std::vector<size_t> ahead;
+  // Cells of tiles in later phases that gained a creature
+  std::vector<size_t> deferred;
+#ifdef OCEAN_PROFILE
+  ProfileCounters profile;
+#endif
+};
+
+/**
+ * Writes ,"key":{"Species":n,...} for the non-zero entries of counts.
+ */
+void writeJsonCounts(std::ostream& out, const char* key, const SpeciesCounts& counts) {
+  out << ",\"" << key << "\":{";
+  bool first = true;
+  for (size_t k = 0; k < counts.size(); ++k) {
+    if (counts[k] == 0) continue;
+    out << (first ? "" : ",") << "\"" << kSpeciesInfo[k].name << "\":" << counts[k];
+    first = false;
+  }
+  out << "}";
+}
+
+// ------------------ thread pool ------------------
+
+/**
+ * Fixed-size pool that runs batches of independent tasks.
+ * The tasks of a batch are dealt round-robin onto per-worker queues; a worker
+ * takes from the back of its own queue and, once it runs dry, steals from the
+ * front of the others. The calling thread takes part as worker 0, so a pool
+ * of N threads starts N - 1 extra threads.
+ */
+class WorkStealingPool {
+public:
+  explicit WorkStealingPool(size_t threads)
+    : queues(std::max<size_t>(1, threads)), generation(0), busy(0), stopping(false),
+      fn(nullptr), ctx(nullptr)
+  {
+    for (size_t w = 1; w < queues.size(); ++w) {
+      workers.emplace_back(&WorkStealingPool::workerLoop, this, w);
+    }
+  }
+
+  ~WorkStealingPool() {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      stopping = true;
+    }
+    wake.notify_all();
+    for (auto& t : workers) {
+      t.join();
+    }
+  }
+
+  size_t size() const { return queues.size(); }
+
+  /**
+   * Calls task(i, worker) for every i in [0, count) and returns once all
+   * calls have finished.
+   */
+  template <class F>
+  void run(size_t count, F& task) {
+    for (size_t w = 0; w < queues.size(); ++w) {
+      Queue& q = queues[w];
+      q.items.clear();
+      for (size_t i = w; i < count; i += queues.size()) {
+        q.items.push_back(i);
+      }
+      q.head = 0;
+      q.tail = q.items.size();
+    }
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      fn = &invoke<F>;
+      ctx = &task;
+      busy = queues.size();
+      generation++;
+    }
+    wake.notify_all();
+    drain(0);
+    std::unique_lock<std::mutex> lock(mutex);
+    done.wait(lock, [this] { return busy == 0; });
+  }
+
+private:
+  struct Queue {
+    std::mutex mutex;
+    std::vector<size_t> items;
+    size_t head = 0;
+    size_t tail = 0;
+  };
+
+  template <class F>
+  static void invoke(void* ctx, size_t item, size_t worker) {
+    (*static_cast<F*>(ctx))(item, worker);
+  }
+
+  void workerLoop(size_t w) {
+    size_t seen = 0;
+    for (;;) {
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        wake.wait(lock, [&] { return stopping || generation != seen; });
+        if (stopping) return;
+        seen = generation;
+      }
+      drain(w);
+    }
+  }
+
+  /**
+   * Runs tasks until no queue has any left, then reports the worker idle.
+   */
+  void drain(size_t w) {
+    size_t item;
+    while (take(w, item)) {
+      fn(ctx, item, w);
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    if (--busy == 0) {
+      done.notify_all();
+    }
+  }
+
+  bool take(size_t w, size_t& item) {
+    {
+      Queue& own = queues[w];
+      std::lock_guard<std::mutex> lock(own.mutex);
+      if (own.head < own.tail) {
+        item = own.items[--own.tail];
+        return true;
+      }
+    }
+    for (size_t k = 1; k < queues.size(); ++k) {
+      Queue& victim = queues[(w + k) % queues.size()];
+      std::lock_guard<std::mutex> lock(victim.mutex);
+      if (victim.head < victim.tail) {
+        item = victim.items[victim.head++];
+        return true;
+      }
+    }
+    return false;
+  }
+
+  std::vector<Queue> queues;
+  std::vector<std::thread> workers;
+  std::mutex mutex;
+  std::condition_variable wake;
+  std::condition_variable done;
+  size_t generation;
+  size_t busy;
+  bool stopping;
+  void (*fn)(void*, size_t, size_t);
+  void* ctx;
+};
+
+// ------------------ terminal rendering ------------------
+
+/**
+ * Draws frames of the ocean on an ANSI terminal. It remembers what every
+ * cell on screen shows, so a frame only moves the cursor to the cells that
+ * changed since the previous one. Each frame is composed in one buffer,
+ * reused from frame to frame, and written with a single write.
+ */
+class TerminalRenderer {
+public:
+  TerminalRenderer() : lastFrame(std::chrono::steady_clock::now()) {}
+
+  /**
+   * Limits frames to maxFps per second (0: no limit).
+   */
+  void setMaxFps(double maxFps) {
+    interval = maxFps > 0 ? std::chrono::duration<double>(1.0 / maxFps)
+                          : std::chrono::duration<double>(0);
+  }
+
+  /**
+   * Whether the frame rate allows drawing a frame now.
+   */
+  bool due() const {
+    return !drawn || std::chrono::steady_clock::now() - lastFrame >= interval;
+  }
+
+  /**
+   * Draws a frame: the header, rows x cols characters and the footer.
+   * glyphAt(i, j) picks the character of each, a number that glyph() turns
+   * into two columns of text. Header and footer are lines ending with
+   * '\n'. The whole screen is redrawn only on the first frame or when the
+   * layout or the glyphs change.
+   */
+  template <typename GlyphAt>
+  void draw(const std::string& header, size_t rows, size_t cols, GlyphAt glyphAt,
+            const char* (*glyph)(uint8_t), const std::string& footer) {
+    size_t lines = static_cast<size_t>(std::count(header.begin(), header.end(), '\n'));
+    bool full = !drawn || rows != shownRows || cols != shownCols || lines != headerLines ||
+                glyph != shownGlyph;
+    frame.clear();
+    frame += full ? "\x1b[H\x1b[2J" : "\x1b[H";
+    appendLines(header);
+    if (full) {
+      shown.assign(rows * cols, static_cast<uint8_t>(kUnknown));
+      shownRows = rows;
+      shownCols = cols;
+      shownGlyph = glyph;
+      headerLines = lines;
+    }
+    for (size_t i = 0; i < rows; ++i) {
+      // Whether the cursor already sits on cell j
+      bool placed = false;
+      for (size_t j = 0; j < cols; ++j) {
+        uint8_t k = static_cast<uint8_t>(glyphAt(i, j));
+        uint8_t& cell = shown[i * cols + j];
+        if (cell == k) {
+          placed = false;
+          continue;
+        }
+        if (!placed) {
+          moveCursor(lines + i + 1, 2 * j + 1);
+        }
+        frame += glyph(k);
+        cell = k;
+        placed = true;
+      }
+    }
+    moveCursor(lines + rows + 1, 1);
+    appendLines(footer);
+    // Anything a longer footer left below
+    frame += "\x1b[J";
+    emit();
+    drawn = true;
+    lastFrame = std::chrono::steady_clock::now();
+  }
+
+private:
+  static const uint8_t kUnknown = 0xff;
+
+  void moveCursor(size_t line, size_t column) {
+    char buf[32];
+    std::snprintf(buf, sizeof(buf), "\x1b[%zu;%zuH", line, column);
+    frame += buf;
+  }
+
+  /**
+   * Appends text, clearing the rest of every line it writes.
+   */
+  void appendLines(const std::string& text) {
+    for (char c : text) {
+      if (c == '\n') frame += "\x1b[K";
+      frame += c;
+    }
+  }
+
+  void emit() {
+#ifdef _WIN32
+    if (!drawn) {
+      HANDLE console = GetStdHandle(STD_OUTPUT_HANDLE);
+      DWORD mode = 0;
+      if (GetConsoleMode(console, &mode)) {
+        SetConsoleMode(console, mode | 0x0004); // ENABLE_VIRTUAL_TERMINAL_PROCESSING
+      }
+    }
+    std::fwrite(frame.data(), 1, frame.size(), stdout);
+    std::fflush(stdout);
+#else
+    std::cout.flush();
+    for (size_t done = 0; done < frame.size();) {
+      ssize_t n = write(STDOUT_FILENO, frame.data() + done, frame.size() - done);
+      if (n < 0 && errno == EINTR) continue;
+      if (n <= 0) break;
+      done += static_cast<size_t>(n);
+    }
+#endif
+  }
+
+  std::string frame;
+  // Species shown in every cell, kUnknown before the first frame
+  std::vector<uint8_t> shown;
+  size_t shownRows = 0;
+  size_t shownCols = 0;
+  size_t headerLines = 0;
+  const char* (*shownGlyph)(uint8_t) = nullptr;
+  bool drawn = false;
+  std::chrono::steady_clock::time_point lastFrame;
+  std::chrono::duration<double> interval = std::chrono::duration<double>(0);
+};
+
+/**
+ * Lines and columns of the terminal: asked from the terminal itself, else
+ * taken from $LINES and $COLUMNS, else 24 x 80.
+ */
+void terminalSize(size_t& lines, size_t& columns) {
+  lines = 24;
+  columns = 80;
+#ifdef _WIN32
+  CONSOLE_SCREEN_BUFFER_INFO screen;
+  if (GetConsoleScreenBufferInfo(GetStdHandle(STD_OUTPUT_HANDLE), &screen)) {
+    lines = static_cast<size_t>(screen.srWindow.Bottom - screen.srWindow.Top + 1);
+    columns = static_cast<size_t>(screen.srWindow.Right - screen.srWindow.Left + 1);
+    return;
+  }
+#else
+  winsize ws;
+  if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == 0 && ws.ws_row > 0 && ws.ws_col > 0) {
+    lines = ws.ws_row;
+    columns = ws.ws_col;
+    return;
+  }
+#endif
+  if (const char* v = std::getenv("LINES")) {
+    if (std::atoi(v) > 0) lines = static_cast<size_t>(std::atoi(v));
+  }
+  if (const char* v = std::getenv("COLUMNS")) {
+    if (std::atoi(v) > 0) columns = static_cast<size_t>(std::atoi(v));
+  }
+}
+
+/**
+ * Keys understood while the ocean is on screen.
+ */
+enum class Key {
+  None,
+  Up,
+  Down,
+  Left,
+  Right,
+  ZoomIn,
+  ZoomOut,
+  Mode,
+  Quit
+};
+
+#ifndef _WIN32
+// Terminal settings for a Keyboard to restore when the process is
+// interrupted, since a signal that kills it skips the destructor
+static termios gKeyboardSaved;
+#endif
+
+/**
+ * Reads keys without waiting and without echo while it exists. Does
+ * nothing when the input is not a terminal. Ctrl-C or SIGTERM restore the
+ * terminal before the process dies of them.
+ */
+class Keyboard {
+public:
+  Keyboard() {
+#ifndef _WIN32
+    active = isatty(STDIN_FILENO) && tcgetattr(STDIN_FILENO, &saved) == 0;
+    if (active) {
+      gKeyboardSaved = saved;
+      previousInt = signal(SIGINT, &Keyboard::interrupted);
+      previousTerm = signal(SIGTERM, &Keyboard::interrupted);
+      termios raw = saved;
+      raw.c_lflag &= ~static_cast<tcflag_t>(ICANON | ECHO);
+      raw.c_cc[VMIN] = 0;
+      raw.c_cc[VTIME] = 0;
+      tcsetattr(STDIN_FILENO, TCSANOW, &raw);
+    }
+#endif
+  }
+
+  Keyboard(const Keyboard&) = delete;
+  Keyboard& operator=(const Keyboard&) = delete;
+
+  ~Keyboard() {
+#ifndef _WIN32
+    if (active) {
+      tcsetattr(STDIN_FILENO, TCSANOW, &saved);
+      signal(SIGINT, previousInt);
+      signal(SIGTERM, previousTerm);
+    }
+#endif
+  }
+
+  /**
+   * Next key pressed, or Key::None.
+   */
+  Key poll() {
+#ifdef _WIN32
+    if (!_kbhit()) return Key::None;
+    int c = _getch();
+    if (c == 0 || c == 224) {
+      switch (_getch()) {
+        case 72: return Key::Up;
+        case 80: return Key::Down;
+        case 75: return Key::Left;
+        case 77: return Key::Right;
+        default: return Key::None;
+      }
+    }
+    return letter(c);
+#else
+    if (!active) return Key::None;
+    char c;
+    if (read(STDIN_FILENO, &c, 1) != 1) return Key::None;
+    if (c != '\x1b') return letter(c);
+    char seq[2];
+    if (read(STDIN_FILENO, &seq[0], 1) != 1 || seq[0] != '[' ||
+        read(STDIN_FILENO, &seq[1], 1) != 1) {
+      return Key::None;
+    }
+    switch (seq[1]) {
+      case 'A': return Key::Up;
+      case 'B': return Key::Down;
+      case 'D': return Key::Left;
+      case 'C': return Key::Right;
+      default: return Key::None;
+    }
+#endif
+  }
+
+private:
+#ifndef _WIN32
+  /**
+   * Restores the terminal, then lets the signal do what it would have.
+   */
+  static void interrupted(int sig) {
+    tcsetattr(STDIN_FILENO, TCSANOW, &gKeyboardSaved);
+    signal(sig, SIG_DFL);
+    raise(sig);
+  }
+#endif
+
+  static Key letter(int c) {
+    switch (std::tolower(c)) {
+      case 'w': return Key::Up;
+      case 's': return Key::Down;
+      case 'a': return Key::Left;
+      case 'd': return Key::Right;
+      case '+': case '=': return Key::ZoomIn;
+      case '-': return Key::ZoomOut;
+      case 'm': return Key::Mode;
+      case 'q': return Key::Quit;
+      default: return Key::None;
+    }
+  }
+
+#ifndef _WIN32
+  termios saved;
+  bool active = false;
+  void (*previousInt)(int) = SIG_DFL;
+  void (*previousTerm)(int) = SIG_DFL;
+#endif
+};
+
+/**
+ * Part of the ocean on screen. At zoom z every character stands for a
+ * z x z block of cells: its dominant species, or with `density` its share
+ * of creatures.
+ */
+struct Viewport {
+  // Cell at the top left corner
+  size_t x = 0;
+  size_t y = 0;
+  // Cells per character along each axis; 0 fits the whole ocean
+  size_t zoom = 1;
+  bool density = false;
+};
+
+/**
+ * Two-column glyphs of the zoomed-out density view, emptiest first.
+ */
+inline const char* densityGlyph(uint8_t level) {
+  static const char* const glyphs[] = {"  ", ". ", ": ", "+ ", "# "};
+  return glyphs[level];
+}
+
+// ------------------ sharding ------------------
+
+/**
+ * Rows beyond each edge of its band that a shard keeps a copy of. An
+ * object reads and writes cells at most 3 steps away.
+ */
+const size_t kHaloRows = 3;
+
+/**
+ * One process of a sharded run: the band of rows [x0, x1) it owns and its
+ * sockets. `up` and `down` lead to the owners of the bands above and below
+ * (wrapping around). Rank 0 coordinates the others through `workers`;
+ * they reach it through `coordinator`.
+ */
+struct Shard {
+  size_t rank = 0;
+  size_t count = 1;
+  size_t x0 = 0;
+  size_t x1 = 0;
+  int up = -1;
+  int down = -1;
+  int coordinator = -1;
+  std::vector<int> workers;
+};
+
+#ifndef _WIN32
+
+[[noreturn]] void shardLinkLost() {
+  std::cerr << "Lost the connection to another shard" << std::endl;
+  std::exit(1);
+}
+
+/**
+ * Sends a message: its length as 8 bytes, then the payload.
+ */
+void sendMessage(int fd, const std::vector<char>& data) {
+  uint64_t size = data.size();
+  const char* parts[2] = {reinterpret_cast<const char*>(&size), data.data()};
+  size_t lengths[2] = {sizeof(size), data.size()};
+  for (int part = 0; part < 2; ++part) {
+    for (size_t done = 0; done < lengths[part];) {
+      ssize_t n = write(fd, parts[part] + done, lengths[part] - done);
+      if (n < 0 && errno == EINTR) continue;
+      if (n <= 0) shardLinkLost();
+      done += static_cast<size_t>(n);
+    }
+  }
+}
+
+/**
+ * Receives a message written by sendMessage().
+ */
+void receiveMessage(int fd, std::vector<char>& data) {
+  uint64_t size = 0;
+  char* parts[2] = {reinterpret_cast<char*>(&size), nullptr};
+  size_t lengths[2] = {sizeof(size), 0};
+  for (int part = 0; part < 2; ++part) {
+    if (part == 1) {
+      data.resize(size);
+      parts[1] = data.data();
+      lengths[1] = data.size();
+    }
+    for (size_t done = 0; done < lengths[part];) {
+      ssize_t n = read(fd, parts[part] + done, lengths[part] - done);
+      if (n < 0 && errno == EINTR) continue;
+      if (n <= 0) shardLinkLost();
+      done += static_cast<size_t>(n);
+    }
+  }
+}
+
+/**
+ * Sends out[i] on links[i] and receives in[i] from it, on both links at
+ * once, so that two shards sending to each other cannot stall on full
+ * socket buffers. Messages are framed as by sendMessage().
+ */
+void exchangeMessages(const int links[2], const std::vector<char> out[2], std::vector<char> in[2]) {
+  uint64_t outSize[2] = {out[0].size(), out[1].size()};
+  uint64_t inSize[2] = {0, 0};
+  size_t sent[2] = {0, 0};
+  size_t received[2] = {0, 0};
+  for (;;) {
+    pollfd fds[2];
+    bool pending = false;
+    for (int i = 0; i < 2; ++i) {
+      fds[i].fd = links[i];
+      fds[i].events = 0;
+      fds[i].revents = 0;
+      if (sent[i] < sizeof(uint64_t) + outSize[i]) fds[i].events |= POLLOUT;
+      if (received[i] < sizeof(uint64_t) + inSize[i]) fds[i].events |= POLLIN;
+      pending = pending || fds[i].events != 0;
+    }
+    if (!pending) break;
+    if (poll(fds, 2, -1) < 0) {
+      if (errno == EINTR) continue;
+      shardLinkLost();
+    }
+    for (int i = 0; i < 2; ++i) {
+      if (fds[i].revents & POLLOUT) {
+        const char* from = sent[i] < sizeof(uint64_t)
+            ? reinterpret_cast<const char*>(&outSize[i]) + sent[i]
+            : out[i].data() + (sent[i] - sizeof(uint64_t));
+        size_t len = sent[i] < sizeof(uint64_t) ? sizeof(uint64_t) - sent[i]
+                                                : sizeof(uint64_t) + outSize[i] - sent[i];
+        ssize_t n = send(links[i], from, len, MSG_DONTWAIT);
+        if (n > 0) {
+          sent[i] += static_cast<size_t>(n);
+        } else if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+          shardLinkLost();
+        }
+      }
+      if (fds[i].revents & (POLLIN | POLLHUP | POLLERR)) {
+        char* to = received[i] < sizeof(uint64_t)
+            ? reinterpret_cast<char*>(&inSize[i]) + received[i]
+            : in[i].data() + (received[i] - sizeof(uint64_t));
+        size_t len = received[i] < sizeof(uint64_t) ? sizeof(uint64_t) - received[i]
+                                                    : sizeof(uint64_t) + inSize[i] - received[i];
+        ssize_t n = recv(links[i], to, len, MSG_DONTWAIT);
+        if (n > 0) {
+          received[i] += static_cast<size_t>(n);
+          if (received[i] == sizeof(uint64_t)) in[i].resize(inSize[i]);
+        } else if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+          shardLinkLost();
+        }
+      }
+    }
+  }
+}
+
+#endif
+
+// ------------------ checkpoints ------------------
+
+/**
+ * Start of a checkpoint file. It is followed by `cellCount` CellState
+ * records, one per non-empty cell, in native byte order. The random
+ * streams are all derived from the seed, the tick and the cell, so the
+ * seed is the whole RNG state. The terrain timer wheel is rebuilt from
+ * the records' due ticks.
+ */
+struct CheckpointHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t recordBytes;
+  uint64_t rows;
+  uint64_t cols;
+  uint64_t seed;
+  uint64_t iterationCount;
+  uint64_t noChangeCounter;
+  uint64_t cellCount;
+  int32_t mix[static_cast<size_t>(Species::Count)];
+  // RuleSet the ocean was simulated under
+  uint32_t rules;
+};
+
+static const char kCheckpointMagic[8] = {'O', 'C', 'E', 'A', 'N', 'C', 'K', 'P'};
+const uint32_t kCheckpointVersion = 2;
+
+static_assert(sizeof(CheckpointHeader) % alignof(CellState) == 0,
+              "records following the header must stay aligned");
+
+/**
+ * A whole file mapped read-only into memory (read into a buffer where
+ * mapping is not available).
+ */
+class MappedFile {
+public:
+  MappedFile() = default;
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+
+  ~MappedFile() {
+#ifndef _WIN32
+    if (bytes) munmap(const_cast<char*>(bytes), length);
+#endif
+  }
+
+  /**
+   * Returns false and sets error if the file cannot be opened or mapped.
+   */
+  bool open(const std::string& path, std::string& error) {
+#ifdef _WIN32
+    std::ifstream in(path, std::ios::binary);
+    if (!in) {
+      error = "cannot open " + path;
+      return false;
+    }
+    buffer.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    bytes = buffer.data();
+    length = buffer.size();
+#else
+    int fd = ::open(path.c_str(), O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) {
+      if (fd >= 0) close(fd);
+      error = "cannot open " + path;
+      return false;
+    }
+    size_t size = static_cast<size_t>(st.st_size);
+    void* mapped = size > 0 ? mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+    close(fd);
+    if (mapped == MAP_FAILED) {
+      error = "cannot map " + path;
+      return false;
+    }
+    bytes = static_cast<const char*>(mapped);
+    length = size;
+#endif
+    return true;
+  }
+
+  const char* data() const { return bytes; }
+  size_t size() const { return length; }
+
+private:
+  const char* bytes = nullptr;
+  size_t length = 0;
+#ifdef _WIN32
+  std::vector<char> buffer;
+#endif
+};
+
+/**
+ * Read-only view of a checkpoint file. The file is mapped rather than
+ * read, so the records are used in place.
+ */
+class CheckpointFile {
+public:
+  /**
+   * Maps and validates a checkpoint. Returns false and sets error if the
+   * file cannot be read or is not a checkpoint this build understands.
+   */
+  bool open(const std::string& path, std::string& error) {
+    if (!file.open(path, error)) {
+      return false;
+    }
+    size_t size = file.size();
+    if (size < sizeof(CheckpointHeader) ||
+        std::memcmp(header().magic, kCheckpointMagic, sizeof(kCheckpointMagic)) != 0) {
+      error = path + " is not a checkpoint";
+      return false;
+    }
+    const CheckpointHeader& h = header();
+    if (h.version != kCheckpointVersion || h.recordBytes != sizeof(CellState) ||
+        h.rules >= static_cast<uint32_t>(RuleSet::Count)) {
+      error = path + " was written by an incompatible version";
+      return false;
+    }
+    if (h.rows == 0 || h.cols == 0 ||
+        (size - sizeof(CheckpointHeader)) / sizeof(CellState) != h.cellCount ||
+        (size - sizeof(CheckpointHeader)) % sizeof(CellState) != 0) {
+      error = path + " is truncated or corrupt";
+      return false;
+    }
+    for (size_t i = 0; i < h.cellCount; ++i) {
+      const CellState& c = cells()[i];
+      if (c.idx >= h.rows * h.cols || c.kind == 0 ||
+          c.kind >= static_cast<uint8_t>(Species::Count)) {
+        error = path + " is truncated or corrupt";
+        return false;
+      }
+    }
+    return true;
+  }
+
+  const CheckpointHeader& header() const {
+    return *reinterpret_cast<const CheckpointHeader*>(file.data());
+  }
+
+  const CellState* cells() const {
+    return reinterpret_cast<const CellState*>(file.data() + sizeof(CheckpointHeader));
+  }
+
+private:
+  MappedFile file;
+};
+
+// ------------------ recording ------------------
+
+/**
+ * Start of a recording. It is followed by frames, each a type byte, the
+ * tick as a varint, the payload length as a varint and the payload:
+ *  - a keyframe holds the whole ocean after that tick: the no-change
+ *    counter, the number of non-empty cells and the cells;
+ *  - a tick frame holds what that tick changed: the no-change counter, the
+ *    events, the storm if any, the number of changed cells and their new
+ *    contents.
+ * Cells are the gap to the previous cell's index (zigzag varint), the
+ * species, then for non-empty cells the record as varints. A tick frame
+ * grows with the number of changed cells only.
+ */
+struct RecordingHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t keyframeEvery;
+  uint64_t rows;
+  uint64_t cols;
+  uint64_t seed;
+  int32_t mix[static_cast<size_t>(Species::Count)];
+  // RuleSet the ocean was simulated under
+  uint32_t rules;
+};
+
+static const char kRecordingMagic[8] = {'O', 'C', 'E', 'A', 'N', 'R', 'E', 'C'};
+const uint32_t kRecordingVersion = 2;
+
+enum class FrameType : uint8_t {
+  Keyframe = 1,
+  Tick = 2
+};
+
+inline void putVarint(std::vector<char>& out, uint64_t v) {
+  while (v >= 0x80) {
+    out.push_back(static_cast<char>(v | 0x80));
+    v >>= 7;
+  }
+  out.push_back(static_cast<char>(v));
+}
+
+inline uint64_t zigzag(int64_t v) {
+  return (static_cast<uint64_t>(v) << 1) ^ static_cast<uint64_t>(v >> 63);
+}
+
+inline int64_t unzigzag(uint64_t v) {
+  return static_cast<int64_t>(v >> 1) ^ -static_cast<int64_t>(v & 1);
+}
+
+/**
+ * Reads varints and bytes from a buffer. Reading past the end yields
+ * zeros and clears `ok`.
+ */
+struct ByteReader {
+  const char* p;
+  const char* end;
+  bool ok = true;
+
+  ByteReader(const char* begin, size_t size) : p(begin), end(begin + size) {}
+
+  uint8_t byte() {
+    if (p == end) {
+      ok = false;
+      return 0;
+    }
+    return static_cast<uint8_t>(*p++);
+  }
+
+  uint64_t varint() {
+    uint64_t v = 0;
+    for (unsigned shift = 0; shift < 64; shift += 7) {
+      uint8_t b = byte();
+      v |= static_cast<uint64_t>(b & 0x7f) << shift;
+      if (!(b & 0x80)) return v;
+    }
+    ok = false;
+    return 0;
+  }
+};
+
+/**
+ * Appends a cell to a frame payload; prev is the index of the cell written
+ * before it.
+ */
+inline void encodeCell(std::vector<char>& out, const CellState& c, uint64_t& prev) {
+  putVarint(out, zigzag(static_cast<int64_t>(c.idx - prev)));
+  prev = c.idx;
+  out.push_back(static_cast<char>(c.kind));
+  if (c.kind == static_cast<uint8_t>(Species::Empty)) return;
+  const int32_t fields[] = {c.age, c.maxAge, c.hunger, c.reproduceCountdown,
+                            c.turnsToTransform};
+  for (int32_t f : fields) {
+    putVarint(out, zigzag(f));
+  }
+  putVarint(out, c.dueTick);
+  out.push_back(static_cast<char>(c.speed));
+  out.push_back(static_cast<char>(c.adult));
+  out.push_back(static_cast<char>(c.flags));
+}
+
+/**
+ * Reads a cell written by encodeCell(). Returns false on malformed data
+ * or a cell outside a grid of the given size.
+ */
+inline bool decodeCell(ByteReader& in, CellState& c, uint64_t& prev, uint64_t size) {
+  c = CellState();
+  c.idx = prev + static_cast<uint64_t>(unzigzag(in.varint()));
+  prev = c.idx;
+  c.kind = in.byte();
+  if (c.kind != static_cast<uint8_t>(Species::Empty)) {
+    int32_t* fields[] = {&c.age, &c.maxAge, &c.hunger, &c.reproduceCountdown,
+                         &c.turnsToTransform};
+    for (int32_t* f : fields) {
+      *f = static_cast<int32_t>(unzigzag(in.varint()));
+    }
+    c.dueTick = in.varint();
+    c.speed = in.byte();
+    c.adult = in.byte();
+    c.flags = in.byte();
+  }
+  return in.ok && c.idx < size && c.kind < static_cast<uint8_t>(Species::Count);
+}
+
+/**
+ * Contents of a tick frame.
+ */
+struct TickRecord {
+  size_t noChangeCounter = 0;
+  TickEvents events;
+  StormEvent storm;
+  std::vector<CellState> cells;
+};
+
+/**
+ * What it takes to undo one replayed tick: the cells the tick changed and
+ * every creature it aged, as they were before it, and the counters of
+ * the tick before.
+ */
+struct ReplayUndo {
+  size_t noChangeCounter = 0;
+  size_t changeCount = 0;
+  TickEvents events;
+  StormEvent storm;
+  std::vector<CellState> cells;
+};
+
+/**
+ * Memory a replay may spend on undo records when playing backwards. Past
+ * it the oldest are dropped, and stepping back beyond the ones left
+ * replays from a keyframe again.
+ */
+const size_t kReplayUndoBytes = size_t(256) << 20;
+
+/**
+ * Writes a recording, frame by frame, as the ocean produces them.
+ */
+class Recorder {
+public:
+  explicit Recorder(size_t keyframeEvery) : every(std::max<size_t>(1, keyframeEvery)) {}
+
+  /**
+   * Creates the file. Returns false and sets error if it cannot.
+   */
+  bool open(const std::string& path, std::string& error) {
+    out.open(path, std::ios::binary | std::ios::trunc);
+    if (!out) {
+      error = "cannot create " + path;
+      return false;
+    }
+    return true;
+  }
+
+  size_t keyframeEvery() const { return every; }
+
+  void writeHeader(size_t rows, size_t cols, uint64_t seed, const SpeciesMix& mix,
+                   RuleSet rules) {
+    RecordingHeader h = RecordingHeader();
+    std::memcpy(h.magic, kRecordingMagic, sizeof(kRecordingMagic));
+    h.version = kRecordingVersion;
+    h.keyframeEvery = static_cast<uint32_t>(every);
+    h.rows = rows;
+    h.cols = cols;
+    h.seed = seed;
+    std::copy(mix.percent, mix.percent + static_cast<size_t>(Species::Count), h.mix);
+    h.rules = static_cast<uint32_t>(rules);
+    out.write(reinterpret_cast<const char*>(&h), sizeof(h));
+  }
+
+  void writeKeyframe(uint64_t tick, size_t noChangeCounter, const std::vector<CellState>& cells) {
+    payload.clear();
+    putVarint(payload, noChangeCounter);
+    putVarint(payload, cells.size());
+    uint64_t prev = 0;
+    for (const CellState& c : cells) {
+      encodeCell(payload, c, prev);
+    }
+    writeFrame(FrameType::Keyframe, tick);
+  }
+
+  void writeTick(uint64_t tick, const TickRecord& r) {
+    payload.clear();
+    putVarint(payload, r.noChangeCounter);
+    const SpeciesCounts* counts[] = {&r.events.births, &r.events.deaths, &r.events.kills,
+                                     &r.events.eaten, &r.events.stormLosses,
+                                     &r.events.transforms};
+    for (const SpeciesCounts* c : counts) {
+      for (size_t n : *c) {
+        putVarint(payload, n);
+      }
+    }
+    payload.push_back(r.storm.occurred ? 1 : 0);
+    if (r.storm.occurred) {
+      putVarint(payload, r.storm.x);
+      putVarint(payload, r.storm.y);
+      putVarint(payload, static_cast<uint64_t>(r.storm.radius));
+    }
+    putVarint(payload, r.cells.size());
+    uint64_t prev = 0;
+    for (const CellState& c : r.cells) {
+      encodeCell(payload, c, prev);
+    }
+    writeFrame(FrameType::Tick, tick);
+  }
+
+  /**
+   * Flushes the file. Returns false if any write failed.
+   */
+  bool close() {
+    out.close();
+    return !out.fail();
+  }
+
+private:
+  void writeFrame(FrameType type, uint64_t tick) {
+    frame.clear();
+    frame.push_back(static_cast<char>(type));
+    putVarint(frame, tick);
+    putVarint(frame, payload.size());
+    out.write(frame.data(), static_cast<std::streamsize>(frame.size()));
+    out.write(payload.data(), static_cast<std::streamsize>(payload.size()));
+  }
+
+  size_t every;
+  std::ofstream out;
+  std::vector<char> frame;
+  std::vector<char> payload;
+};
+
+/**
+ * Read-only view of a recording, indexed by tick on opening so that any
+ * tick can be reached from the keyframe before it.
+ */
+class RecordingFile {
+public:
+  struct Frame {
+    uint64_t tick;
+    const char* data;
+    size_t size;
+  };
+
+  /**
+   * Maps and indexes a recording. A frame cut short, as left by a run that
+   * was killed, ends the recording. Returns false and sets error if the
+   * file is not a recording this build understands.
+   */
+  bool open(const std::string& path, std::string& error) {
+    if (!file.open(path, error)) {
+      return false;
+    }
+    if (file.size() < sizeof(RecordingHeader) ||
+        std::memcmp(header().magic, kRecordingMagic, sizeof(kRecordingMagic)) != 0) {
+      error = path + " is not a recording";
+      return false;
+    }
+    if (header().version != kRecordingVersion ||
+        header().rules >= static_cast<uint32_t>(RuleSet::Count)) {
+      error = path + " was written by an incompatible version";
+      return false;
+    }
+    ByteReader in(file.data() + sizeof(RecordingHeader), file.size() - sizeof(RecordingHeader));
+    while (in.p != in.end) {
+      uint8_t type = in.byte();
+      Frame f;
+      f.tick = in.varint();
+      f.size = static_cast<size_t>(in.varint());
+      if (!in.ok || f.size > static_cast<size_t>(in.end - in.p)) break;
+      f.data = in.p;
+      in.p += f.size;
+      if (type == static_cast<uint8_t>(FrameType::Keyframe)) {
+        if (!keyframes.empty() && f.tick != lastTick()) break;
+        keyframes.push_back(f);
+      } else if (type == static_cast<uint8_t>(FrameType::Tick)) {
+        if (keyframes.empty() || f.tick != lastTick() + 1) break;
+        ticks.push_back(f);
+      } else {
+        break;
+      }
+    }
+    if (header().rows == 0 || header().cols == 0 || keyframes.empty()) {
+      error = path + " is truncated or corrupt";
+      return false;
+    }
+    return true;
+  }
+
+  const RecordingHeader& header() const {
+    return *reinterpret_cast<const RecordingHeader*>(file.data());
+  }
+
+  uint64_t firstTick() const { return keyframes.front().tick; }
+  uint64_t lastTick() const { return keyframes.front().tick + ticks.size(); }
+
+  /**
+   * The last keyframe strictly before tick, or the first one.
+   */
+  const Frame& keyframeBefore(uint64_t tick) const {
+    auto after = std::lower_bound(keyframes.begin(), keyframes.end(), tick,
+                                  [](const Frame& f, uint64_t t) { return f.tick < t; });
+    return after == keyframes.begin() ? keyframes.front() : *(after - 1);
+  }
+
+  /**
+   * Frame of a tick in (firstTick(), lastTick()].
+   */
+  const Frame& tickFrame(uint64_t tick) const {
+    return ticks[tick - firstTick() - 1];
+  }
+
+  bool readKeyframe(const Frame& f, size_t& noChangeCounter, std::vector<CellState>& cells) const {
+    ByteReader in(f.data, f.size);
+    noChangeCounter = static_cast<size_t>(in.varint());
+    uint64_t count = in.varint();
+    if (!in.ok || count > f.size) return false;
+    cells.resize(static_cast<size_t>(count));
+    uint64_t prev = 0;
+    for (CellState& c : cells) {
+      if (!decodeCell(in, c, prev, header().rows * header().cols)) return false;
+    }
+    return true;
+  }
+
+  bool readTick(const Frame& f, TickRecord& r) const {
+    ByteReader in(f.data, f.size);
+    r.noChangeCounter = static_cast<size_t>(in.varint());
+    SpeciesCounts* counts[] = {&r.events.births, &r.events.deaths, &r.events.kills,
+                               &r.events.eaten, &r.events.stormLosses, &r.events.transforms};
+    for (SpeciesCounts* c : counts) {
+      for (size_t& n : *c) {
+        n = static_cast<size_t>(in.varint());
+      }
+    }
+    r.storm = StormEvent();
+    r.storm.occurred = in.byte() != 0;
+    if (r.storm.occurred) {
+      r.storm.x = static_cast<size_t>(in.varint());
+      r.storm.y = static_cast<size_t>(in.varint());
+      r.storm.radius = static_cast<int>(in.varint());
+    }
+    uint64_t count = in.varint();
+    if (!in.ok || count > f.size) return false;
+    r.cells.resize(static_cast<size_t>(count));
+    uint64_t prev = 0;
+    for (CellState& c : r.cells) {
+      if (!decodeCell(in, c, prev, header().rows * header().cols)) return false;
+    }
+    return true;
+  }
+
+private:
+  MappedFile file;
+  std::vector<Frame> keyframes;
+  std::vector<Frame> ticks;
+};
+
+// ------------------ time series ------------------
+
+/**
+ * Everything exported about one iteration. Rows are plain values so that
+ * the ticking thread only copies them; choosing the columns and formatting
+ * them is left to the writer thread.
+ */
+struct SeriesRow {
+  uint64_t tick;
+  SpeciesCounts population;
+  TickEvents events;
+  StormEvent storm;
+  // Mean age and hunger of the living creatures of each species
+  std::array<double, static_cast<size_t>(Species::Count)> meanAge;
+  std::array<double, static_cast<size_t>(Species::Count)> meanHunger;
+};
+
+/**
+ * Calls v.integer(group, species, value) or v.real(group, species, value)
+ * for every column of a row, in file order. Species is null for the
+ * columns that are not per species. Only species an event can happen to
+ * get a column for it; a storm radius of 0 means there was no storm.
+ */
+template <class Visitor>
+void visitSeriesColumns(const SeriesRow& r, Visitor& v) {
+  const size_t stone = static_cast<size_t>(Species::Stone);
+  const size_t reef = static_cast<size_t>(Species::Reef);
+  const size_t prey = static_cast<size_t>(Species::Prey);
+  const size_t predator = static_cast<size_t>(Species::Predator);
+  const size_t count = static_cast<size_t>(Species::Count);
+  v.integer("tick", nullptr, r.tick);
+  for (size_t k = stone; k < count; ++k) {
+    v.integer("population", kSpeciesInfo[k].name, r.population[k]);
+  }
+  for (size_t k = prey; k < count; ++k) {
+    v.integer("births", kSpeciesInfo[k].name, r.events.births[k]);
+  }
+  for (size_t k = prey; k < count; ++k) {
+    v.integer("deaths", kSpeciesInfo[k].name, r.events.deaths[k]);
+  }
+  for (size_t k = predator; k < count; ++k) {
+    v.integer("kills", kSpeciesInfo[k].name, r.events.kills[k]);
+  }
+  for (size_t k = prey; k < count; ++k) {
+    v.integer("eaten", kSpeciesInfo[k].name, r.events.eaten[k]);
+  }
+  for (size_t k = stone; k < count; ++k) {
+    v.integer("storm_losses", kSpeciesInfo[k].name, r.events.stormLosses[k]);
+  }
+  for (size_t k = stone; k <= reef; ++k) {
+    v.integer("transforms", kSpeciesInfo[k].name, r.events.transforms[k]);
+  }
+  v.integer("storm_x", nullptr, r.storm.occurred ? r.storm.x : 0);
+  v.integer("storm_y", nullptr, r.storm.occurred ? r.storm.y : 0);
+  v.integer("storm_radius", nullptr, r.storm.occurred ? static_cast<uint64_t>(r.storm.radius) : 0);
+  for (size_t k = prey; k < count; ++k) {
+    v.real("mean_age", kSpeciesInfo[k].name, r.meanAge[k]);
+  }
+  for (size_t k = predator; k < count; ++k) {
+    v.real("mean_hunger", kSpeciesInfo[k].name, r.meanHunger[k]);
+  }
+}
+
+/**
+ * Start of a binary time series. It is followed by one column descriptor
+ * per column, a type byte (0: uint64, 1: double), a name length byte and
+ * the name, then by blocks: a uint64 row count and every column's values
+ * for those rows, one column after the other, in native byte order.
+ */
+struct SeriesHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t columns;
+};
+
+static const char kSeriesMagic[8] = {'O', 'C', 'E', 'A', 'N', 'T', 'S', '\0'};
+const uint32_t kSeriesVersion = 1;
+
+/**
+ * Rows handed to the writer thread at once, and full batches that may wait
+ * for it before append() blocks.
+ */
+const size_t kSeriesBatchRows = 1024;
+const size_t kSeriesMaxPending = 8;
+
+/**
+ * Writes one row per iteration to a CSV file, or to a binary columnar
+ * file unless the name ends in ".csv". append() only copies the row into
+ * the current batch; full batches are formatted and written by a
+ * background thread.
+ */
+class SeriesWriter {
+public:
+  SeriesWriter() {}
+  SeriesWriter(const SeriesWriter&) = delete;
+  SeriesWriter& operator=(const SeriesWriter&) = delete;
+
+  ~SeriesWriter() {
+    close();
+  }
+
+  /**
+   * Creates the file, writes the column names and starts the writer
+   * thread. Returns false and sets error if the file cannot be created.
+   */
+  bool open(const std::string& path, std::string& error) {
+    csv = path.size() >= 4 && path.compare(path.size() - 4, 4, ".csv") == 0;
+    out.open(path, csv ? std::ios::trunc : std::ios::binary | std::ios::trunc);
+    if (!out) {
+      error = "cannot create " + path;
+      return false;
+    }
+    SeriesRow blank = SeriesRow();
+    if (csv) {
+      CsvHeader header;
+      visitSeriesColumns(blank, header);
+      header.text.back() = '\n';
+      out << header.text;
+    } else {
+      ColumnHeader header;
+      visitSeriesColumns(blank, header);
+      SeriesHeader h = SeriesHeader();
+      std::memcpy(h.magic, kSeriesMagic, sizeof(kSeriesMagic));
+      h.version = kSeriesVersion;
+      h.columns = header.columns;
+      out.write(reinterpret_cast<const char*>(&h), sizeof(h));
+      out.write(header.bytes.data(), static_cast<std::streamsize>(header.bytes.size()));
+      columns = header.columns;
+    }
+    filling.reserve(kSeriesBatchRows);
+    stopping = false;
+    writer = std::thread(&SeriesWriter::writeLoop, this);
+    return true;
+  }
+
+  void append(const SeriesRow& r) {
+    filling.push_back(r);
+    if (filling.size() == kSeriesBatchRows) handOver();
+  }
+
+  /**
+   * Writes the remaining rows, stops the writer thread and closes the
+   * file. Returns false if any write failed.
+   */
+  bool close() {
+    if (!writer.joinable()) return !failed;
+    if (!filling.empty()) handOver();
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      stopping = true;
+    }
+    wake.notify_one();
+    writer.join();
+    out.close();
+    failed = failed || out.fail();
+    return !failed;
+  }
+
+private:
+  struct CsvHeader {
+    std::string text;
+    void integer(const char* group, const char* species, uint64_t) { add(group, species); }
+    void real(const char* group, const char* species, double) { add(group, species); }
+    void add(const char* group, const char* species) {
+      text += group;
+      if (species) text += std::string("_") + species;
+      text += ',';
+    }
+  };
+
+  struct CsvRow {
+    std::string& text;
+    void integer(const char*, const char*, uint64_t v) {
+      char buf[24];
+      int n = std::snprintf(buf, sizeof(buf), "%llu,", static_cast<unsigned long long>(v));
+      text.append(buf, static_cast<size_t>(n));
+    }
+    void real(const char*, const char*, double v) {
+      char buf[32];
+      int n = std::snprintf(buf, sizeof(buf), "%.3f,", v);
+      text.append(buf, static_cast<size_t>(n));
+    }
+  };
+
+  struct ColumnHeader {
+    std::vector<char> bytes;
+    uint32_t columns = 0;
+    void integer(const char* group, const char* species, uint64_t) { add(0, group, species); }
+    void real(const char* group, const char* species, double) { add(1, group, species); }
+    void add(char type, const char* group, const char* species) {
+      std::string name = group;
+      if (species) name += std::string("_") + species;
+      bytes.push_back(type);
+      bytes.push_back(static_cast<char>(name.size()));
+      bytes.insert(bytes.end(), name.begin(), name.end());
+      columns++;
+    }
+  };
+
+  // Puts the values of row `row` of a block of `rows` rows in place
+  struct ColumnBlock {
+    char* data;
+    size_t rows;
+    size_t row;
+    size_t column;
+    void integer(const char*, const char*, uint64_t v) { put(&v); }
+    void real(const char*, const char*, double v) { put(&v); }
+    void put(const void* v) {
+      std::memcpy(data + (column++ * rows + row) * 8, v, 8);
+    }
+  };
+
+  /**
+   * Queues the current batch for the writer thread, waiting while too
+   * many batches are queued already, and takes an empty one.
+   */
+  void handOver() {
+    std::unique_lock<std::mutex> lock(mutex);
+    drained.wait(lock, [this] { return pending.size() < kSeriesMaxPending; });
+    pending.push_back(std::move(filling));
+    if (spare.empty()) {
+      filling = std::vector<SeriesRow>();
+      filling.reserve(kSeriesBatchRows);
+    } else {
+      filling = std::move(spare.back());
+      spare.pop_back();
+    }
+    lock.unlock();
+    wake.notify_one();
+  }
+
+  void writeLoop() {
+    std::vector<std::vector<SeriesRow>> batches;
+    for (;;) {
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        for (std::vector<SeriesRow>& b : batches) {
+          b.clear();
+          spare.push_back(std::move(b));
+        }
+        batches.clear();
+        wake.wait(lock, [this] { return stopping || !pending.empty(); });
+        if (pending.empty()) return;
+        batches.swap(pending);
+      }
+      drained.notify_one();
+      for (const std::vector<SeriesRow>& b : batches) {
+        writeBatch(b);
+      }
+    }
+  }
+
+  void writeBatch(const std::vector<SeriesRow>& rows) {
+    if (csv) {
+      text.clear();
+      CsvRow format = {text};
+      for (const SeriesRow& r : rows) {
+        visitSeriesColumns(r, format);
+        text.back() = '\n';
+      }
+      out.write(text.data(), static_cast<std::streamsize>(text.size()));
+    } else {
+      uint64_t count = rows.size();
+      block.resize(count * columns * 8);
+      for (size_t i = 0; i < rows.size(); ++i) {
+        ColumnBlock place = {block.data(), rows.size(), i, 0};
+        visitSeriesColumns(rows[i], place);
+      }
+      out.write(reinterpret_cast<const char*>(&count), sizeof(count));
+      out.write(block.data(), static_cast<std::streamsize>(block.size()));
+    }
+    if (!out) failed = true;
+  }
+
+  bool csv = false;
+  size_t columns = 0;
+  std::ofstream out;
+  // Batch being filled by the ticking thread
+  std::vector<SeriesRow> filling;
+  // Full batches waiting for the writer, and emptied ones to reuse
+  std::vector<std::vector<SeriesRow>> pending;
+  std::vector<std::vector<SeriesRow>> spare;
+  std::mutex mutex;
+  std::condition_variable wake;
+  std::condition_variable drained;
+  bool stopping = false;
+  std::atomic<bool> failed{false};
+  std::thread writer;
+  // Formatting buffers of the writer thread
+  std::string text;
+  std::vector<char> block;
+};
+
+// ------------------ scenarios ------------------
+
+/**
+ * Start of a binary scenario. It is followed by the species of every cell,
+ * one byte each, row by row, zero-padded to a multiple of 8 bytes, and
+ * then by `attributeCount` CellAttributes records in native byte order.
+ */
+struct ScenarioHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t recordBytes;
+  uint64_t rows;
+  uint64_t cols;
+  uint64_t attributeCount;
+};
+
+static const char kScenarioMagic[8] = {'O', 'C', 'E', 'A', 'N', 'S', 'C', 'N'};
+const uint32_t kScenarioVersion = 1;
+
+/**
+ * Which fields of a CellAttributes record a scenario sets.
+ */
+enum AttributeBits : uint8_t {
+  kSetAge = 1,
+  kSetMaxAge = 2,
+  kSetHunger = 4,
+  kSetReproduce = 8,
+  kSetTurns = 16,
+  kSetSpeed = 32
+};
+
+/**
+ * Attributes a scenario gives one cell. They replace the ones drawn at
+ * random when the cell is filled; only the fields flagged in `set` do.
+ */
+struct CellAttributes {
+  uint64_t idx;
+  int32_t age;
+  int32_t maxAge;
+  int32_t hunger;
+  int32_t reproduceCountdown;
+  // Countdown of a Stone or Reef
+  int32_t turnsToTransform;
+  uint8_t speed;
+  uint8_t set;
+  uint8_t pad[2];
+};
+
+/**
+ * Name of an attribute in text scenarios, the field it sets and its range.
+ */
+struct AttributeInfo {
+  const char* name;
+  AttributeBits bit;
+  int32_t min;
+  int32_t max;
+};
+
+static const AttributeInfo kAttributeInfo[] = {
+  {"age",       kSetAge,       0, INT_MAX},
+  {"max_age",   kSetMaxAge,    0, INT_MAX},
+  {"hunger",    kSetHunger,    0, INT_MAX},
+  {"reproduce", kSetReproduce, 0, INT_MAX},
+  {"turns",     kSetTurns,     0, INT_MAX},
+  {"speed",     kSetSpeed,     0, 3},
+};
+
+inline int32_t attributeValue(const CellAttributes& a, AttributeBits bit) {
+  switch (bit) {
+    case kSetAge:       return a.age;
+    case kSetMaxAge:    return a.maxAge;
+    case kSetHunger:    return a.hunger;
+    case kSetReproduce: return a.reproduceCountdown;
+    case kSetTurns:     return a.turnsToTransform;
+    default:            return a.speed;
+  }
+}
+
+inline void setAttribute(CellAttributes& a, AttributeBits bit, int32_t v) {
+  switch (bit) {
+    case kSetAge:       a.age = v; break;
+    case kSetMaxAge:    a.maxAge = v; break;
+    case kSetHunger:    a.hunger = v; break;
+    case kSetReproduce: a.reproduceCountdown = v; break;
+    case kSetTurns:     a.turnsToTransform = v; break;
+    default:            a.speed = static_cast<uint8_t>(v); break;
+  }
+  a.set |= bit;
+}
+
+/**
+ * Cells and bytes of layout handled by one task when a scenario is parsed.
+ */
+const size_t kScenarioBlockBytes = size_t(1) << 20;
+
+/**
+ * Symbol of a species in the layout of a text scenario: the one drawn on
+ * screen, and '.' for Empty so that rows survive editors that trim spaces.
+ */
+inline char scenarioSymbol(Species k) {
+  return k == Species::Empty ? '.' : kSpeciesInfo[static_cast<size_t>(k)].symbol[0];
+}
+
+/**
+ * The size of an ocean and, optionally, the species of every cell and
+ * attributes for some of them.
+ *
+ * A text scenario starts with "rows cols", after any blank or '#' comment
+ * lines. It may go on with the layout, one line per row and one symbol
+ * per cell (see scenarioSymbol(); ' ' is Empty too, and short lines and
+ * missing rows are Empty), and end with lines "@ row col name=value..."
+ * setting the attributes of non-empty cells. Without a layout the ocean
+ * is filled at random. A binary scenario is described by ScenarioHeader.
+ *
+ * The file is mapped, and the layout parsed (or, if binary, checked) by
+ * blocks of whole rows on a thread pool.
+ */
+class ScenarioFile {
+public:
+  /**
+   * Maps and parses a scenario on `threads` threads (0: one per core).
+   * Returns false and sets error if it cannot be read or is malformed.
+   */
+  bool open(const std::string& path, size_t threads, std::string& error) {
+    if (!file.open(path, error)) {
+      return false;
+    }
+    if (threads == 0) {
+      threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    bool binary = file.size() >= sizeof(kScenarioMagic) &&
+                  std::memcmp(file.data(), kScenarioMagic, sizeof(kScenarioMagic)) == 0;
+    if (!(binary ? openBinary(threads, error) : openText(threads, error))) {
+      error = path + ": " + error;
+      return false;
+    }
+    return true;
+  }
+
+  size_t rows() const { return nRows; }
+  size_t cols() const { return nCols; }
+
+  /**
+   * Species of every cell, row by row, or null if the scenario gives only
+   * a size.
+   */
+  const uint8_t* layout() const { return cells; }
+
+  const std::vector<CellAttributes>& attributes() const { return attrs; }
+
+private:
+  /**
+   * Where a block of the layout starts and the first error found in it.
+   */
+  struct Block {
+    const char* begin;
+    const char* end;
+    size_t firstRow;
+    size_t lines;
+    bool hasCells;
+    size_t errorLine;
+    std::string error;
+  };
+
+  static const char* lineEnd(const char* p, const char* end) {
+    const char* eol = static_cast<const char*>(std::memchr(p, '\n', end - p));
+    return eol ? eol : end;
+  }
+
+  static bool isSpace(char c) {
+    return c == ' ' || c == '\t' || c == '\r';
+  }
+
+  static bool isBlank(const char* p, const char* end) {
+    while (p != end && isSpace(*p)) ++p;
+    return p == end;
+  }
+
+  /**
+   * Reads an optionally signed decimal number after any spaces, leaving p
+   * after it. Returns false if there is none or it has over 18 digits.
+   */
+  static bool readNumber(const char*& p, const char* end, int64_t& v) {
+    while (p != end && isSpace(*p)) ++p;
+    bool negative = p != end && *p == '-';
+    if (negative) ++p;
+    const char* digits = p;
+    v = 0;
+    while (p != end && *p >= '0' && *p <= '9' && p - digits < 18) {
+      v = v * 10 + (*p++ - '0');
+    }
+    if (negative) v = -v;
+    return p != digits && (p == end || *p < '0' || *p > '9');
+  }
+
+  /**
+   * Checks the size of the ocean and that a layout of it can be indexed.
+   */
+  bool setSize(uint64_t r, uint64_t c) {
+    if (r == 0 || c == 0 || r > SIZE_MAX / c) {
+      return false;
+    }
+    nRows = static_cast<size_t>(r);
+    nCols = static_cast<size_t>(c);
+    return true;
+  }
+
+  bool openText(size_t threads, std::string& error) {
+    const char* p = file.data();
+    const char* end = p + file.size();
+    size_t line = 1;
+    while (p != end && (*p == '#' || isBlank(p, lineEnd(p, end)))) {
+      p = lineEnd(p, end);
+      if (p != end) ++p;
+      ++line;
+    }
+    const char* eol = lineEnd(p, end);
+    int64_t r = 0, c = 0;
+    if (!readNumber(p, eol, r) || !readNumber(p, eol, c) || !isBlank(p, eol) || r < 0 || c < 0 ||
+        !setSize(static_cast<uint64_t>(r), static_cast<uint64_t>(c))) {
+      error = "line " + std::to_string(line) + ": expected \"rows cols\"";
+      return false;
+    }
+    const char* body = eol == end ? end : eol + 1;
+    size_t bodyLine = line + 1;
+
+    // The attributes start at the first line that begins with '@'
+    const char* attrBegin = body;
+    for (;;) {
+      attrBegin = static_cast<const char*>(std::memchr(attrBegin, '@', end - attrBegin));
+      if (!attrBegin) {
+        attrBegin = end;
+        break;
+      }
+      if (attrBegin == body || attrBegin[-1] == '\n') break;
+      ++attrBegin;
+    }
+
+    // Cut the layout into blocks of whole lines, count the lines of each
+    // to find its first row, then parse the blocks
+    size_t blockCount = std::max<size_t>(1, (attrBegin - body) / kScenarioBlockBytes);
+    std::vector<Block> blocks(blockCount);
+    const char* from = body;
+    for (size_t b = 0; b < blockCount; ++b) {
+      const char* to = b + 1 == blockCount
+          ? attrBegin : std::max(from, body + (b + 1) * (attrBegin - body) / blockCount);
+      if (to != attrBegin) {
+        to = lineEnd(to, attrBegin);
+        if (to != attrBegin) ++to;
+      }
+      blocks[b].begin = from;
+      blocks[b].end = to;
+      blocks[b].errorLine = 0;
+      from = to;
+    }
+    WorkStealingPool pool(std::min(threads, blockCount));
+    auto count = [&](size_t b, size_t) {
+      Block& k = blocks[b];
+      k.lines = static_cast<size_t>(std::count(k.begin, k.end, '\n'));
+      if (k.end != k.begin && k.end[-1] != '\n') ++k.lines;
+      k.hasCells = false;
+      for (const char* q = k.begin; q != k.end && !k.hasCells; ++q) {
+        k.hasCells = !isSpace(*q) && *q != '\n';
+      }
+    };
+    pool.run(blockCount, count);
+    bool hasLayout = false;
+    size_t layoutLines = 0;
+    for (Block& k : blocks) {
+      k.firstRow = layoutLines;
+      layoutLines += k.lines;
+      hasLayout = hasLayout || k.hasCells;
+    }
+
+    if (hasLayout) {
+      uint8_t kinds[256];
+      std::fill(kinds, kinds + 256, static_cast<uint8_t>(Species::Count));
+      for (size_t k = 0; k < static_cast<size_t>(Species::Count); ++k) {
+        kinds[static_cast<unsigned char>(scenarioSymbol(static_cast<Species>(k)))] =
+            static_cast<uint8_t>(k);
+      }
+      kinds[static_cast<unsigned char>(' ')] = static_cast<uint8_t>(Species::Empty);
+      parsed.assign(nRows * nCols, static_cast<uint8_t>(Species::Empty));
+      auto parse = [&](size_t b, size_t) {
+        Block& k = blocks[b];
+        size_t row = k.firstRow;
+        for (const char* q = k.begin; q != k.end; ++row) {
+          const char* e = lineEnd(q, k.end);
+          const char* next = e == k.end ? e : e + 1;
+          while (e != q && e[-1] == '\r') --e;
+          if (row >= nRows || static_cast<size_t>(e - q) > nCols) {
+            if (row < nRows || !isBlank(q, e)) {
+              k.errorLine = bodyLine + row;
+              k.error = row < nRows ? "more than " + std::to_string(nCols) + " cells"
+                                    : "more than " + std::to_string(nRows) + " rows";
+              return;
+            }
+          } else {
+            uint8_t* out = &parsed[row * nCols];
+            for (const char* s = q; s != e; ++s, ++out) {
+              *out = kinds[static_cast<unsigned char>(*s)];
+              if (*out == static_cast<uint8_t>(Species::Count)) {
+                k.errorLine = bodyLine + row;
+                k.error = std::string("unknown symbol '") + *s + "'";
+                return;
+              }
+            }
+          }
+          q = next;
+        }
+      };
+      pool.run(blockCount, parse);
+      for (const Block& k : blocks) {
+        if (k.errorLine) {
+          error = "line " + std::to_string(k.errorLine) + ": " + k.error;
+          return false;
+        }
+      }
+      cells = parsed.data();
+    }
+    return parseAttributes(attrBegin, end, bodyLine + layoutLines, error);
+  }
+
+  /**
+   * Parses the "@ row col name=value..." lines of a text scenario.
+   */
+  bool parseAttributes(const char* p, const char* end, size_t line, std::string& error) {
+    for (; p != end; ++line) {
+      const char* eol = lineEnd(p, end);
+      const char* next = eol == end ? eol : eol + 1;
+      if (isBlank(p, eol)) {
+        p = next;
+        continue;
+      }
+      std::string where = "line " + std::to_string(line) + ": ";
+      int64_t r = 0, c = 0;
+      if (*p++ != '@' || !readNumber(p, eol, r) || !readNumber(p, eol, c) ||
+          r < 0 || c < 0 || static_cast<uint64_t>(r) >= nRows || static_cast<uint64_t>(c) >= nCols) {
+        error = where + "expected \"@ row col name=value...\" inside the ocean";
+        return false;
+      }
+      CellAttributes a = CellAttributes();
+      a.idx = static_cast<uint64_t>(r) * nCols + static_cast<uint64_t>(c);
+      if (!cells || cells[a.idx] == static_cast<uint8_t>(Species::Empty)) {
+        error = where + "attributes of a cell the layout leaves empty";
+        return false;
+      }
+      while (!isBlank(p, eol)) {
+        while (isSpace(*p)) ++p;
+        const char* name = p;
+        while (p != eol && *p != '=' && !isSpace(*p)) ++p;
+        const AttributeInfo* info = nullptr;
+        for (const AttributeInfo& i : kAttributeInfo) {
+          if (std::strlen(i.name) == static_cast<size_t>(p - name) &&
+              std::memcmp(i.name, name, p - name) == 0) {
+            info = &i;
+          }
+        }
+        int64_t v = 0;
+        if (!info || p == eol || *p++ != '=' || !readNumber(p, eol, v)) {
+          error = where + "expected name=value, with name one of age, max_age, hunger,"
+                          " reproduce, turns, speed";
+          return false;
+        }
+        if (v < info->min || v > info->max) {
+          error = where + info->name + " out of range";
+          return false;
+        }
+        setAttribute(a, info->bit, static_cast<int32_t>(v));
+      }
+      attrs.push_back(a);
+      p = next;
+    }
+    return true;
+  }
+
+  bool openBinary(size_t threads, std::string& error) {
+    ScenarioHeader h;
+    if (file.size() < sizeof(h)) {
+      error = "truncated scenario";
+      return false;
+    }
+    std::memcpy(&h, file.data(), sizeof(h));
+    if (h.version != kScenarioVersion || h.recordBytes != sizeof(CellAttributes)) {
+      error = "written by an incompatible version";
+      return false;
+    }
+    if (!setSize(h.rows, h.cols) ||
+        (file.size() - sizeof(h)) / sizeof(CellAttributes) < h.attributeCount) {
+      error = "truncated or corrupt";
+      return false;
+    }
+    size_t cellCount = nRows * nCols;
+    size_t layoutBytes = (cellCount + 7) / 8 * 8;
+    if (layoutBytes < cellCount ||
+        file.size() - sizeof(h) - h.attributeCount * sizeof(CellAttributes) != layoutBytes) {
+      error = "truncated or corrupt";
+      return false;
+    }
+    cells = reinterpret_cast<const uint8_t*>(file.data() + sizeof(h));
+
+    // Check the species by blocks of rows
+    size_t blockRows = std::max<size_t>(1, kScenarioBlockBytes / nCols);
+    size_t blockCount = (nRows + blockRows - 1) / blockRows;
+    std::vector<size_t> badRow(blockCount, SIZE_MAX);
+    auto check = [&](size_t b, size_t) {
+      size_t last = std::min(nRows, (b + 1) * blockRows);
+      for (size_t row = b * blockRows; row < last; ++row) {
+        const uint8_t* q = cells + row * nCols;
+        uint8_t worst = *std::max_element(q, q + nCols);
+        if (worst >= static_cast<uint8_t>(Species::Count)) {
+          badRow[b] = row;
+          return;
+        }
+      }
+    };
+    WorkStealingPool pool(std::min(threads, blockCount));
+    pool.run(blockCount, check);
+    for (size_t row : badRow) {
+      if (row != SIZE_MAX) {
+        error = "unknown species in row " + std::to_string(row);
+        return false;
+      }
+    }
+
+    attrs.resize(h.attributeCount);
+    if (!attrs.empty()) {
+      std::memcpy(attrs.data(), file.data() + sizeof(h) + layoutBytes,
+                  attrs.size() * sizeof(CellAttributes));
+    }
+    for (const CellAttributes& a : attrs) {
+      if (a.idx >= cellCount || cells[a.idx] == static_cast<uint8_t>(Species::Empty) ||
+          a.speed > 3) {
+        error = "truncated or corrupt";
+        return false;
+      }
+    }
+    return true;
+  }
+
+  MappedFile file;
+  size_t nRows = 0;
+  size_t nCols = 0;
+  const uint8_t* cells = nullptr;
+  // Layout of a text scenario
+  std::vector<uint8_t> parsed;
+  std::vector<CellAttributes> attrs;
+};
+
+/**
+ * Writes a scenario, as text if the path ends in ".txt" and binary
+ * otherwise. Returns false on I/O errors.
+ */
+bool writeScenario(const std::string& path, size_t rows, size_t cols,
+                   const std::vector<uint8_t>& layout, const std::vector<CellAttributes>& attrs) {
+  std::ofstream out(path.c_str(), std::ios::binary | std::ios::trunc);
+  bool text = path.size() >= 4 && path.compare(path.size() - 4, 4, ".txt") == 0;
+  if (text) {
+    out << rows << " " << cols << "\n";
+    std::string line;
+    for (size_t i = 0; i < rows; ++i) {
+      line.clear();
+      for (size_t j = 0; j < cols; ++j) {
+        line += scenarioSymbol(static_cast<Species>(layout[i * cols + j]));
+      }
+      line += '\n';
+      out.write(line.data(), static_cast<std::streamsize>(line.size()));
+    }
+    for (const CellAttributes& a : attrs) {
+      out << "@ " << a.idx / cols << " " << a.idx % cols;
+      for (const AttributeInfo& info : kAttributeInfo) {
+        if (a.set & info.bit) out << " " << info.name << "=" << attributeValue(a, info.bit);
+      }
+      out << "\n";
+    }
+  } else {
+    ScenarioHeader h = ScenarioHeader();
+    std::memcpy(h.magic, kScenarioMagic, sizeof(kScenarioMagic));
+    h.version = kScenarioVersion;
+    h.recordBytes = sizeof(CellAttributes);
+    h.rows = rows;
+    h.cols = cols;
+    h.attributeCount = attrs.size();
+    out.write(reinterpret_cast<const char*>(&h), sizeof(h));
+    out.write(reinterpret_cast<const char*>(layout.data()),
+              static_cast<std::streamsize>(layout.size()));
+    const char padding[8] = {};
+    out.write(padding, static_cast<std::streamsize>((8 - layout.size() % 8) % 8));
+    out.write(reinterpret_cast<const char*>(attrs.data()),
+              static_cast<std::streamsize>(attrs.size() * sizeof(CellAttributes)));
+  }
+  out.close();
+  return static_cast<bool>(out);
+}
+
+// ------------------ timer wheel ------------------
+
+/**
+ * Hierarchical timer wheel holding the pending terrain transformations.
+ * Level l has 64 buckets of 64^l ticks each; an entry sits on the lowest
+ * level whose span covers its delay and drops down a level whenever the
+ * wheel reaches the start of its bucket. Scheduling and firing are O(1)
+ * per entry and nothing is touched between events.
+ */
+class TimerWheel {
+public:
+  struct Entry {
+    uint64_t due;
+    size_t cell;
+    uint32_t slot;
+  };
+
+  TimerWheel() : now(0), pending(0) {}
+
+  /**
+   * Drops every entry and restarts the wheel at tick t.
+   */
+  void reset(uint64_t t) {
+    for (auto& level : buckets) {
+      for (std::vector<Entry>& bucket : level) {
+        bucket.clear();
+      }
+    }
+    now = t;
+    pending = 0;
+  }
+
+  /**
+   * Adds an entry due at or after the current tick.
+   */
+  void schedule(const Entry& e) {
+    place(e);
+    pending++;
+  }
+
+  /**
+   * Moves the wheel to tick t, which must follow the previous one, and
+   * appends the entries due at t to out.
+   */
+  void advance(uint64_t t, std::vector<Entry>& out) {
+    now = t;
+    for (int level = kLevels - 1; level > 0; --level) {
+      if ((now & ((uint64_t(1) << (kBits * level)) - 1)) != 0) continue;
+      std::vector<Entry>& bucket = buckets[level][(now >> (kBits * level)) & kMask];
+      cascade.swap(bucket);
+      for (const Entry& e : cascade) {
+        place(e);
+      }
+      cascade.clear();
+    }
+    std::vector<Entry>& bucket = buckets[0][now & kMask];
+    for (const Entry& e : bucket) {
+      if (e.due <= now) {
+        out.push_back(e);
+        pending--;
+      } else {
+        cascade.push_back(e);
+      }
+    }
+    bucket.clear();
+    // Entries beyond the top level's span wrap around and go back in
+    for (const Entry& e : cascade) {
+      place(e);
+    }
+    cascade.clear();
+  }
+
+  size_t size() const { return pending; }
+
+private:
+  static const int kBits = 6;
+  static const int kLevels = 4;
+  static const uint64_t kMask = (1 << kBits) - 1;
+
+  void place(const Entry& e) {
+    uint64_t delay = e.due > now ? e.due - now : 0;
+    int level = 0;
+    while (level + 1 < kLevels && delay >= (uint64_t(1) << (kBits * (level + 1)))) {
+      level++;
+    }
+    buckets[level][(std::max(e.due, now) >> (kBits * level)) & kMask].push_back(e);
+  }
+
+  std::vector<Entry> buckets[kLevels][kMask + 1];
+  std::vector<Entry> cascade;
+  uint64_t now;
+  size_t pending;
+};
+
+/**
+ * A cell holding a creature to visit. `order` packs the scheduling tile
+ * into the high bits and the cell's row and column inside the tile into
+ * the low ones, so sorting by it groups the visits by tile, in sweep order.
+ */
+struct AgentRef {
+  uint64_t order;
+  size_t cell;
+
+  bool operator<(const AgentRef& o) const { return order < o.order; }
+};
+
+/**
+ * Side length of a scheduling tile. An object reads and writes cells at
+ * most 3 steps away (apex speed), so tiles of the same colour, which are
+ * always separated by at least one other tile, can never touch the same
+ * cell as long as tiles are at least 7 cells wide.
+ */
+const size_t kTileSize = 16;
+
+/**
+ * Splits an axis of length n into tiles of at least kTileSize cells.
+ */
+inline size_t tileCount(size_t n) {
+  return std::max<size_t>(1, n / kTileSize);
+}
+
+/**
+ * Colour of tile i out of n along one axis. Neighbouring tiles, including
+ * the pair joined by the toroidal wrap, never share a colour.
+ */
+inline size_t tileColour(size_t i, size_t n) {
+  if (n % 2 == 1 && n > 1 && i == n - 1) return 2;
+  return i % 2;
+}
+
+/**
+ * Rectangle of cells [x0, x0 + rows) x [y0, y0 + cols).
+ */
+struct Area {
+  size_t x0, y0;
+  size_t rows, cols;
+};
+
+/**
+ * The Ocean class: manages the grid of objects and the main simulation loop.
+ * Rules is the rule set the species follow, e.g. ClassicRules.
+ */
+template <class Rules>
+class Ocean {
+public:
+  Ocean(size_t r, size_t c, uint64_t seed, const SpeciesMix& mix = kDefaultMix)
+    : Ocean(r, c, seed, mix, Area{0, 0, r, c}) {}
+
+  /**
+   * Creates an ocean in which only the cells of `populated` are filled from
+   * the species mix; everything else starts Empty and costs no memory until
+   * something moves into it.
+   *
+   * With a shard, the ocean is one process of a sharded run: only the rows
+   * of the shard's band and its halo are filled, and ticks exchange the
+   * halo rows with the neighbouring shards.
+   */
+  Ocean(size_t r, size_t c, uint64_t seed, const SpeciesMix& mix, const Area& populated,
+        const Shard* shard = nullptr)
+    : rows(r), cols(c), seed(seed), iterationCount(0), noChangeCounter(0),
+      maxIterations(5000), mix(mix), scratch(1), shard(shard)
+  {
+    buildTiles(1, 1);
+    field.resize(rows, cols);
+    if (shard) {
+      field.haloRows.assign(rows, 0);
+      for (size_t i = 0; i < 2 * kHaloRows; ++i) {
+        field.haloRows[(shard->x0 + rows - kHaloRows + i) % rows] = 1;
+        field.haloRows[(shard->x1 + rows - kHaloRows + i) % rows] = 2;
+      }
+    }
+    for (size_t i = populated.x0; i < populated.x0 + populated.rows && i < rows; ++i) {
+      if (!holdsRow(i)) continue;
+      for (size_t j = populated.y0; j < populated.y0 + populated.cols && j < cols; ++j) {
+        randomObject(i * cols + j);
+      }
+    }
+    scheduleAllTerrain();
+    // Every shard built the same halo rows
+    scratch[0].log.halo.clear();
+    collectChanges();
+  }
+
+  /**
+   * Creates an ocean from a scenario, which it no longer needs once built.
+   * The cells of the layout get records drawn from the seed, as in a
+   * random ocean, and then the attributes the scenario gives them. A
+   * scenario without a layout is filled from the default species mix.
+   */
+  Ocean(const ScenarioFile& scenario, uint64_t seed)
+    : rows(scenario.rows()), cols(scenario.cols()), seed(seed), iterationCount(0),
+      noChangeCounter(0), maxIterations(5000), mix(kDefaultMix), scratch(1), shard(nullptr)
+  {
+    buildTiles(1, 1);
+    field.resize(rows, cols);
+    const uint8_t* layout = scenario.layout();
+    ChangeLog& log = scratch[0].log;
+    size_t filled = 0;
+    for (size_t i = 0; i < rows; ++i) {
+      for (size_t j = 0; j < cols; ++j) {
+        size_t idx = i * cols + j;
+        if (!layout) {
+          randomObject(idx);
+        } else if (layout[idx] != static_cast<uint8_t>(Species::Empty)) {
+          CellRng rng(seed, 0, idx, RngStream::Init);
+          spawn<Rules>(static_cast<Species>(layout[idx]), field, idx, rng, log);
+        }
+      }
+      // Settle each band of tiles as it fills, so that the log of a huge
+      // ocean does not hold every cell at once
+      if ((i + 1) % kStorageTileSide == 0) {
+        filled += log.cells.size();
+        field.settle(log);
+        log.cells.clear();
+      }
+    }
+    for (const CellAttributes& a : scenario.attributes()) {
+      CellState c = field.save(a.idx);
+      if (a.set & kSetAge) c.age = a.age;
+      if (a.set & kSetMaxAge) c.maxAge = a.maxAge;
+      if (a.set & kSetHunger) c.hunger = a.hunger;
+      if (a.set & kSetReproduce) c.reproduceCountdown = a.reproduceCountdown;
+      if (a.set & kSetTurns) c.turnsToTransform = a.turnsToTransform;
+      if (a.set & kSetSpeed) c.speed = a.speed;
+      field.load(c, log);
+    }
+    if (layout) {
+      SpeciesCounts counts = population();
+      mix.name = "scenario";
+      for (size_t k = 0; k < counts.size(); ++k) {
+        mix.percent[k] = static_cast<int>((counts[k] * 200 + rows * cols) / (rows * cols * 2));
+      }
+    }
+    scheduleAllTerrain();
+    collectChanges();
+    lastChangeCount += filled;
+  }
+
+  /**
+   * Resumes the ocean saved in a checkpoint, which it no longer needs
+   * once built.
+   */
+  explicit Ocean(const CheckpointFile& checkpoint)
+    : rows(checkpoint.header().rows), cols(checkpoint.header().cols),
+      seed(checkpoint.header().seed), iterationCount(checkpoint.header().iterationCount),
+      noChangeCounter(checkpoint.header().noChangeCounter), maxIterations(5000),
+      mix(kDefaultMix), scratch(1), shard(nullptr)
+  {
+    const CheckpointHeader& h = checkpoint.header();
+    mix.name = "checkpoint";
+    std::copy(h.mix, h.mix + static_cast<size_t>(Species::Count), mix.percent);
+    buildTiles(1, 1);
+    field.resize(rows, cols);
+    loadState(iterationCount, noChangeCounter, checkpoint.cells(), h.cellCount);
+  }
+
+  /**
+   * Creates an empty ocean of the size, seed and mix of a recording, to be
+   * moved through it with seek().
+   */
+  explicit Ocean(const RecordingFile& recording)
+    : rows(recording.header().rows), cols(recording.header().cols),
+      seed(recording.header().seed), iterationCount(0), noChangeCounter(0), maxIterations(5000),
+      mix(kDefaultMix), scratch(1), shard(nullptr)
+  {
+    const RecordingHeader& h = recording.header();
+    mix.name = "recording";
+    std::copy(h.mix, h.mix + static_cast<size_t>(Species::Count), mix.percent);
+    buildTiles(1, 1);
+    field.resize(rows, cols);
+  }
+
+  ~Ocean() {
+    waitForCheckpoint();
+  }
+
+  /**
+   * Advances the simulation by one iteration:
+   *  - Let each object tick and perform actions
+   *  - Sometimes trigger a "storm" event at random
+   * Returns false once the ocean has not changed for a while or we reached
+   * the iteration limit.
+   */
+  bool step() {
+    OCEAN_PROFILE_TICK(profiler);
+    reservePoolSpace();
+    updateTerrain();
+    if (shard) exchangeHalo(kNoPhase);
+    updateAgents();
+
+    // Occasionally trigger a random storm
+    lastStorm.occurred = false;
+    CellRng stormRng(seed, iterationCount, 0, RngStream::Storm);
+    if (stormRng.below(1000) < 3) {
+      lastStorm.occurred = true;
+      lastStorm.x = stormRng.below(static_cast<int>(rows));
+      lastStorm.y = stormRng.below(static_cast<int>(cols));
+      lastStorm.radius = 1 + stormRng.below(3);
+      applyStorm(Action::storm(lastStorm.x * cols + lastStorm.y, lastStorm.radius));
+    }
+
+    collectChanges();
+
+    iterationCount++;
+    if (lastChangeCount == 0) {
+      noChangeCounter++;
+    } else {
+      noChangeCounter = 0;
+    }
+    // After the counters, so that the checkpoint holds the whole tick
+    if (checkpointEvery > 0 && iterationCount % checkpointEvery == 0) {
+      startCheckpoint();
+    }
+    if (recorder) recordTick();
+    if (series) exportTick();
+
+    return !finished();
+  }
+
+  /**
+   * Main simulation loop:
+   *  - Display the stats and the ocean, unless the frame rate forbids it
+   *  - Advance one iteration and wait for the tick delay
+   *  - Stop if no changes happen for a while or we exceed a large iteration count
+   */
+  void run() {
+    bool running = true;
+    Keyboard keyboard;
+    while (running && !finished()) {
+      for (Key key = keyboard.poll(); key != Key::None; key = keyboard.poll()) {
+        running = handleKey(key) && running;
+      }
+      if (renderer.due()) {
+        display("");
+      }
+      if (!running) break;
+      step();
+      if (tickDelayMs > 0) {
+        sleepMs(tickDelayMs);
+      }
+    }
+    finishCheckpoints();
+
+    display("\nSimulation ended. Press Enter to exit.\n");
+    std::cin.get();
+  }
+
+  /**
+   * Sets the part of the ocean run() and replay() show first.
+   */
+  void setViewport(const Viewport& v) {
+    view = v;
+    view.x %= rows;
+    view.y %= cols;
+  }
+
+  /**
+   * Batch loop: advances the simulation without touching the terminal or
+   * sleeping, then writes a one-line JSON summary with the final population
+   * and the achieved tick rate. Never reads from stdin.
+   */
+  void runHeadless(std::ostream& out) {
+    auto start = std::chrono::steady_clock::now();
+    while (!finished() && step()) {
+    }
+    finishCheckpoints();
+    if (shard) {
+      gatherShards();
+      if (shard->rank != 0) return;
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    writeSummary(out, elapsed.count());
+  }
+
+  /**
+   * Switches to the tiled engine running on the given number of threads.
+   * The grid is cut into tiles that are coloured so that tiles updated at
+   * the same time are too far apart to interact; the colours are processed
+   * one after another and the tiles of a colour go to a work-stealing pool.
+   * The result depends only on the seed, not on the number of threads, but
+   * differs from the default row-by-row update order.
+   */
+  void setThreads(size_t threads) {
+    pool.reset(new WorkStealingPool(threads));
+    scratch.resize(pool->size());
+    buildTiles(tileCount(rows), tileCount(cols));
+  }
+
+  /**
+   * Number of cells whose content changed during the last iteration.
+   */
+  size_t changeCount() const { return lastChangeCount; }
+
+  /**
+   * Enables the list of changed cells returned by changedCells().
+   */
+  void setTrackChanges(bool on) { trackChanges = on; }
+
+  /**
+   * Cells changed during the last iteration, in increasing order when
+   * several threads contributed. Only filled when tracking is enabled.
+   */
+  const std::vector<size_t>& changedCells() const { return changedList; }
+
+  /**
+   * Sets how many iterations run() and runHeadless() perform at most.
+   */
+  void setMaxIterations(size_t n) { maxIterations = n; }
+
+  /**
+   * Sets the pause after every iteration of run() and replay(), and the
+   * most frames per second they draw (0: one per iteration).
+   */
+  void setPacing(int tickMs, double maxFps) {
+    tickDelayMs = tickMs;
+    renderer.setMaxFps(maxFps);
+  }
+
+  /**
+   * Saves the ocean to path every `every` iterations (0: never) and at
+   * the end of run() and runHeadless(). Periodic checkpoints are written
+   * by a forked copy of the process, so the ticks go on meanwhile; one
+   * falling due while the previous is still being written is skipped.
+   */
+  void setCheckpoint(const std::string& path, size_t every) {
+    checkpointPath = path;
+    checkpointEvery = every;
+  }
+
+  /**
+   * Records every following iteration. Writes the recording header and a
+   * keyframe of the current iteration first.
+   */
+  void setRecorder(Recorder* r) {
+    recorder = r;
+    if (!recorder) return;
+    trackChanges = true;
+    recorder->writeHeader(rows, cols, seed, mix, Rules::id);
+    std::vector<CellState> cells;
+    forEachCell([&cells](const CellState& c) { cells.push_back(c); });
+    recorder->writeKeyframe(iterationCount, noChangeCounter, cells);
+  }
+
+#ifdef OCEAN_PROFILE
+  /**
+   * Starts timing the phases of every following iteration and frame.
+   */
+  void startProfile() { profiler.start(); }
+
+  /**
+   * Prints what the profiler measured so far.
+   */
+  void writeProfile(std::ostream& out) const {
+    ProfileCounters workers;
+    for (const WorkerScratch& ws : scratch) {
+      workers.add(ws.profile);
+    }
+    profiler.report(out, workers, pool ? pool->size() : 1);
+  }
+#endif
+
+  /**
+   * Exports a row of statistics for every following iteration.
+   */
+  void setSeries(SeriesWriter* s) { series = s; }
+
+  /**
+   * Moves the ocean to the state recorded after a tick, clamped to the
+   * recorded range: from the keyframe before it, or from the current state
+   * when that is on the way. Going back, it undoes the ticks in between
+   * when their undo records reach that far; otherwise it replays from the
+   * keyframe and keeps undo records of the ticks replayed, so that the
+   * next steps back are undone rather than replayed again. Returns false
+   * if the recording is corrupt.
+   */
+  bool seek(const RecordingFile& recording, uint64_t tick) {
+    tick = std::max(recording.firstTick(), std::min(recording.lastTick(), tick));
+    bool back = replayLoaded && tick < iterationCount;
+    if (back && iterationCount - tick <= replayUndo.size()) {
+      while (iterationCount > tick) {
+        undoReplayTick();
+      }
+      return true;
+    }
+    const RecordingFile::Frame& key = recording.keyframeBefore(tick);
+    if (back || iterationCount < key.tick || !replayLoaded) {
+      std::vector<CellState> cells;
+      size_t noChange = 0;
+      if (!recording.readKeyframe(key, noChange, cells)) return false;
+      loadState(key.tick, noChange, cells.data(), cells.size());
+      replayLoaded = true;
+    }
+    // Undo records must end at the current iteration
+    replayUndo.clear();
+    replayUndoBytes = 0;
+    TickRecord r;
+    while (iterationCount < tick) {
+      if (!recording.readTick(recording.tickFrame(iterationCount + 1), r)) return false;
+      if (back) saveReplayUndo(r);
+      replayTick(r);
+    }
+    return true;
+  }
+
+  /**
+   * Plays a recording on screen, one tick per frame, from tick `from` to
+   * tick `to`, backwards if `to` comes first. Returns false if the
+   * recording is corrupt.
+   */
+  bool replay(const RecordingFile& recording, uint64_t from, uint64_t to) {
+    to = std::max(recording.firstTick(), std::min(recording.lastTick(), to));
+    if (!seek(recording, from)) return false;
+    Keyboard keyboard;
+    while (iterationCount != to) {
+      bool playing = true;
+      for (Key key = keyboard.poll(); key != Key::None; key = keyboard.poll()) {
+        playing = handleKey(key) && playing;
+      }
+      if (!playing) break;
+      if (renderer.due()) {
+        display("");
+      }
+      if (tickDelayMs > 0) {
+        sleepMs(tickDelayMs);
+      }
+      if (!seek(recording, iterationCount < to ? iterationCount + 1 : iterationCount - 1)) {
+        return false;
+      }
+    }
+    display("\nReplay ended. Press Enter to exit.\n");
+    std::cin.get();
+    return true;
+  }
+
+  /**
+   * Plays a recording from tick `from` to tick `to` without drawing it and
+   * writes the same summary as runHeadless(), for the state reached.
+   * Returns false if the recording is corrupt.
+   */
+  bool replayHeadless(const RecordingFile& recording, uint64_t from, uint64_t to,
+                      std::ostream& out) {
+    to = std::max(recording.firstTick(), std::min(recording.lastTick(), to));
+    auto start = std::chrono::steady_clock::now();
+    if (!seek(recording, from)) return false;
+    while (iterationCount != to) {
+      if (!seek(recording, iterationCount < to ? iterationCount + 1 : iterationCount - 1)) {
+        return false;
+      }
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    writeSummary(out, elapsed.count());
+    return true;
+  }
+
+  /**
+   * Writes a checkpoint of the current iteration, through a temporary
+   * file so that an interrupted write never replaces a good checkpoint.
+   * Returns false on I/O errors.
+   */
+  bool writeCheckpoint(const std::string& path) const {
+    CheckpointHeader h = CheckpointHeader();
+    std::memcpy(h.magic, kCheckpointMagic, sizeof(kCheckpointMagic));
+    h.version = kCheckpointVersion;
+    h.recordBytes = sizeof(CellState);
+    h.rows = rows;
+    h.cols = cols;
+    h.seed = seed;
+    h.iterationCount = iterationCount;
+    h.noChangeCounter = noChangeCounter;
+    h.cellCount = rows * cols - population()[0];
+    std::copy(mix.percent, mix.percent + static_cast<size_t>(Species::Count), h.mix);
+    h.rules = static_cast<uint32_t>(Rules::id);
+
+    std::string temp = path + ".tmp";
+    std::ofstream out(temp, std::ios::binary | std::ios::trunc);
+    out.write(reinterpret_cast<const char*>(&h), sizeof(h));
+    std::vector<CellState> records;
+    auto flush = [&]() {
+      out.write(reinterpret_cast<const char*>(records.data()),
+                static_cast<std::streamsize>(records.size() * sizeof(CellState)));
+      records.clear();
+    };
+    forEachCell([&](const CellState& c) {
+      records.push_back(c);
+      if (records.size() == 4096) flush();
+    });
+    flush();
+    out.close();
+    if (!out) {
+      std::remove(temp.c_str());
+      return false;
+    }
+#ifdef _WIN32
+    std::remove(path.c_str());
+#endif
+    return std::rename(temp.c_str(), path.c_str()) == 0;
+  }
+
+  /**
+   * Saves the ocean as a scenario: its layout, and for every non-empty
+   * cell the attributes of its record as of the current iteration. A new
+   * ocean saved and loaded with the same seed gives the same run. Returns
+   * false on I/O errors.
+   */
+  bool writeScenario(const std::string& path) const {
+    std::vector<uint8_t> layout(rows * cols, static_cast<uint8_t>(Species::Empty));
+    std::vector<CellAttributes> attrs;
+    forEachCell([&](const CellState& c) {
+      Species k = static_cast<Species>(c.kind);
+      layout[c.idx] = c.kind;
+      CellAttributes a = CellAttributes();
+      a.idx = c.idx;
+      if (k == Species::Stone || k == Species::Reef) {
+        setAttribute(a, kSetTurns, terrainCountdown(field.pool(k), field.slotAt(c.idx)));
+      } else {
+        setAttribute(a, kSetAge, c.age);
+        setAttribute(a, kSetMaxAge, c.maxAge);
+        setAttribute(a, kSetHunger, c.hunger);
+        setAttribute(a, kSetReproduce, c.reproduceCountdown);
+        setAttribute(a, kSetSpeed, c.speed);
+      }
+      attrs.push_back(a);
+    });
+    return ::writeScenario(path, rows, cols, layout, attrs);
+  }
+
+  /**
+   * FNV-1a hash over the complete cell state: the position, species and
+   * record of every non-empty cell, tile by tile. Two runs with the same
+   * seed and size produce the same hash.
+   */
+  uint64_t gridHash() const {
+    uint64_t h = 0xcbf29ce484222325ULL;
+    auto feed = [&h](const void* data, size_t len) {
+      const unsigned char* p = static_cast<const unsigned char*>(data);
+      for (size_t i = 0; i < len; ++i) {
+        h = (h ^ p[i]) * 0x100000001b3ULL;
+      }
+    };
+    for (const StorageTile* t : field.sortedTiles()) {
+      size_t x0 = t->key / field.tilesY * kStorageTileSide;
+      size_t y0 = t->key % field.tilesY * kStorageTileSide;
+      for (size_t o = 0; o < kStorageTileCells; ++o) {
+        Species k = t->kind[o];
+        if (k == Species::Empty) continue;
+        uint64_t idx = (x0 + o / kStorageTileSide) * cols + y0 + o % kStorageTileSide;
+        feed(&idx, sizeof(idx));
+        feed(&k, sizeof(k));
+        // Hash record contents, not slot numbers, which depend on reuse order
+        const CreaturePool& p = field.pool(k);
+        uint32_t i = t->slot[o];
+        feed(&p.age[i], sizeof(int32_t));
+        feed(&p.maxAge[i], sizeof(int32_t));
+        feed(&p.hunger[i], sizeof(int32_t));
+        feed(&p.reproduceCountdown[i], sizeof(int32_t));
+        int32_t turns = k == Species::Stone || k == Species::Reef ? terrainCountdown(p, i)
+                                                                  : p.turnsToTransform[i];
+        feed(&turns, sizeof(int32_t));
+        feed(&p.speed[i], 1);
+        feed(&p.adult[i], 1);
+      }
+    }
+    return h;
+  }
+
+  /**
+   * How many objects of each species are present in the ocean, read from
+   * the live counters of the pools.
+   */
+  SpeciesCounts population() const {
+    SpeciesCounts counts;
+    counts[0] = field.size();
+    for (size_t k = 1; k < counts.size(); ++k) {
+      counts[k] = field.pools[k].live;
+      counts[0] -= counts[k];
+    }
+    return counts;
+  }
+
+  /**
+   * Counts the objects of each species by walking every allocated tile.
+   * Used to check the counters in debug builds.
+   */
+  SpeciesCounts recount() const {
+    SpeciesCounts counts;
+    counts.fill(0);
+    for (const StorageTile* t : field.liveTiles) {
+      for (Species k : t->kind) {
+        counts[static_cast<size_t>(k)]++;
+      }
+    }
+    counts[0] = field.size();
+    for (size_t k = 1; k < counts.size(); ++k) {
+      counts[0] -= counts[k];
+    }
+    return counts;
+  }
+
+  /**
+   * Population and events of the last iteration, as shown on screen and
+   * written by the exporters.
+   */
+  OceanStats stats() const {
+    OceanStats s;
+    s.iteration = iterationCount;
+    s.noChangeCounter = noChangeCounter;
+    s.changedCells = lastChangeCount;
+    s.liveTiles = field.liveTiles.size();
+    s.population = population();
+    s.lastTick = lastEvents;
+    return s;
+  }
+
+  /**
+   * Whether the ocean has not changed for long enough to stop.
+   */
+  bool isStable() const { return noChangeCounter > 150; }
+
+private:
   size_t rows;
   size_t cols;
-  std::vector<std::shared_ptr<Object>> field;
+  uint64_t seed;
+  CellStore field;
   size_t iterationCount;
   size_t noChangeCounter;
+  size_t maxIterations;
+  SpeciesMix mix;
+  StormEvent lastStorm;
+  std::unique_ptr<WorkStealingPool> pool;
+  // One set of buffers per thread of the pool (a single one without pool)
+  std::vector<WorkerScratch> scratch;
+  size_t lastChangeCount = 0;
+  TickEvents lastEvents;
+  // Where to record each iteration, if anywhere
+  Recorder* recorder = nullptr;
+  TickRecord recordScratch;
+  std::vector<size_t> recordCells;
+  // Where to export each iteration's statistics, if anywhere
+  SeriesWriter* series = nullptr;
+  // Whether seek() has loaded a keyframe yet
+  bool replayLoaded = false;
+  // Undo records of the latest replayed ticks, the last one undoing the
+  // current iteration, and their size in bytes
+  std::deque<ReplayUndo> replayUndo;
+  size_t replayUndoBytes = 0;
+  // Screen output of run() and replay()
+  TerminalRenderer renderer;
+  Viewport view;
+  std::ostringstream status;
+  int tickDelayMs = 120;
+  // Where and how often to save the ocean; empty path for never
+  std::string checkpointPath;
+  size_t checkpointEvery = 0;
+#ifndef _WIN32
+  // Process writing the last periodic checkpoint, or -1
+  pid_t checkpointWriter = -1;
+#endif
+  bool trackChanges = false;
+  std::vector<size_t> changedList;
+  // Creatures to visit, grouped by the colour of their tile, in the order
+  // the colours are processed
+  std::vector<std::vector<AgentRef>> phaseAgents;
+  // Where each tile's run starts in the phase being processed
+  std::vector<size_t> tileStarts;
+  // Tile row of every grid row, tile column of every grid column, and
+  // their positions inside the tile
+  std::vector<uint32_t> rowTile;
+  std::vector<uint32_t> colTile;
+  std::vector<uint32_t> rowInTile;
+  std::vector<uint32_t> colInTile;
+  size_t tilesPerRow = 1;
+  size_t tilesPerCol = 1;
+  size_t coloursY = 2;
+  // Bits of AgentRef::order taken by the column and by the whole position
+  // inside a tile
+  unsigned colBits = 0;
+  unsigned spanBits = 0;
+  // Pending Stone/Reef transformations, and the ones due this tick
+  TimerWheel terrainWheel;
+  std::vector<TimerWheel::Entry> dueTerrain;
+  // Band and links of a sharded run, null otherwise
+  const Shard* shard;
+  // Halo cells to send, and the messages to and from the neighbours above
+  // and below
+  std::vector<size_t> haloCells;
+  std::vector<char> haloOut[2];
+  std::vector<char> haloIn[2];
+
+  static const size_t kNoPhase = static_cast<size_t>(-1);
+
+#ifdef OCEAN_PROFILE
+  Profiler profiler;
+
+  /**
+   * Counters of the ticking thread, or of the thread owning ws, if
+   * profiling.
+   */
+  ProfileCounters* profiled() { return profiler.on() ? &profiler.counters() : nullptr; }
+  ProfileCounters* profiled(WorkerScratch& ws) const {
+    return profiler.on() ? &ws.profile : nullptr;
+  }
+
+  /**
+   * Counters of the thread owning ws, if the creature it visits is timed.
+   */
+  ProfileCounters* timed(WorkerScratch& ws) const {
+    return profiler.on() && ws.profile.timing ? &ws.profile : nullptr;
+  }
+#else
+  static ProfileCounters* profiled() { return nullptr; }
+  static ProfileCounters* profiled(WorkerScratch&) { return nullptr; }
+  static ProfileCounters* timed(WorkerScratch&) { return nullptr; }
+#endif
+
+  /**
+   * One-line JSON summary of the current iteration: size, engine, timing,
+   * population, last tick's events and pool usage.
+   */
+  void writeSummary(std::ostream& out, double seconds) const {
+    OceanStats s = stats();
+    const char* kernelName = agingKernelName();
+    out << "{\"rows\":" << rows << ",\"cols\":" << cols
+        << ",\"seed\":" << seed
+        << ",\"rules\":\"" << ruleSetName(Rules::id) << "\""
+        << ",\"threads\":" << (pool ? pool->size() : 0)
+        << ",\"shards\":" << (shard ? shard->count : 1)
+        << ",\"aging_kernel\":\"" << kernelName << "\""
+        << ",\"ticks\":" << iterationCount
+        << ",\"stop\":\"" << (isStable() ? "stable" : "limit") << "\""
+        << ",\"seconds\":" << seconds
+        << ",\"ticks_per_second\":" << (seconds > 0 ? iterationCount / seconds : 0.0)
+        << ",\"bytes_per_cell\":" << CellStore::bytesPerCell()
+        << ",\"live_tiles\":" << s.liveTiles
+        << ",\"tile_bytes\":" << field.tileBytes()
+        << ",\"grid_hash\":\"" << std::hex << gridHash() << std::dec << "\""
+        << ",\"pool_bytes\":" << field.poolBytes()
+        << ",\"population\":{";
+    for (size_t k = 0; k < s.population.size(); ++k) {
+      out << (k ? "," : "") << "\"" << kSpeciesInfo[k].name << "\":" << s.population[k];
+    }
+    out << "},\"last_tick\":{\"changed_cells\":" << s.changedCells;
+    writeJsonCounts(out, "births", s.lastTick.births);
+    writeJsonCounts(out, "deaths", s.lastTick.deaths);
+    writeJsonCounts(out, "kills", s.lastTick.kills);
+    writeJsonCounts(out, "eaten", s.lastTick.eaten);
+    writeJsonCounts(out, "storm_losses", s.lastTick.stormLosses);
+    writeJsonCounts(out, "transforms", s.lastTick.transforms);
+    out << "},\"pools\":{";
+    for (size_t k = 1; k < static_cast<size_t>(Species::Count); ++k) {
+      const CreaturePool& p = field.pools[k];
+      out << (k > 1 ? "," : "") << "\"" << kSpeciesInfo[k].name << "\":{\"live\":" << p.live
+          << ",\"high_water\":" << p.highWater << ",\"capacity\":" << p.capacity() << "}";
+    }
+    out << "}}" << std::endl;
+  }
+
+  /**
+   * Starts writing a periodic checkpoint in a child process, which keeps
+   * a copy-on-write image of the ocean as of now.
+   */
+  void startCheckpoint() {
+    OCEAN_PROFILE_PHASE(profiler, Phase::Output);
+    if (checkpointPath.empty()) return;
+#ifdef _WIN32
+    reportCheckpoint(writeCheckpoint(checkpointPath));
+#else
+    if (checkpointWriter > 0) {
+      int status = 0;
+      if (waitpid(checkpointWriter, &status, WNOHANG) == 0) return;
+      reportCheckpoint(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+      checkpointWriter = -1;
+    }
+    std::cout.flush();
+    pid_t pid = fork();
+    if (pid == 0) {
+      std::_Exit(writeCheckpoint(checkpointPath) ? 0 : 1);
+    }
+    if (pid < 0) {
+      reportCheckpoint(writeCheckpoint(checkpointPath));
+    } else {
+      checkpointWriter = pid;
+    }
+#endif
+  }
+
+  /**
+   * Waits until the periodic checkpoint being written, if any, is done.
+   */
+  void waitForCheckpoint() {
+#ifndef _WIN32
+    if (checkpointWriter > 0) {
+      int status = 0;
+      pid_t done = waitpid(checkpointWriter, &status, 0);
+      reportCheckpoint(done == checkpointWriter && WIFEXITED(status) && WEXITSTATUS(status) == 0);
+      checkpointWriter = -1;
+    }
+#endif
+  }
+
+  /**
+   * Writes the final checkpoint once the periodic one being written, which
+   * would otherwise overwrite it, is done.
+   */
+  void finishCheckpoints() {
+    waitForCheckpoint();
+    if (!checkpointPath.empty()) {
+      reportCheckpoint(writeCheckpoint(checkpointPath));
+    }
+  }
+
+  void reportCheckpoint(bool ok) const {
+    if (!ok) {
+      std::cerr << "Could not write checkpoint " << checkpointPath << std::endl;
+    }
+  }
+
+  /**
+   * Calls f with the state of every non-empty cell, tile by tile.
+   */
+  template <typename F>
+  void forEachCell(F f) const {
+    for (const StorageTile* t : field.sortedTiles()) {
+      size_t x0 = t->key / field.tilesY * kStorageTileSide;
+      size_t y0 = t->key % field.tilesY * kStorageTileSide;
+      for (size_t o = 0; o < kStorageTileCells; ++o) {
+        if (t->kind[o] == Species::Empty) continue;
+        f(field.save((x0 + o / kStorageTileSide) * cols + y0 + o % kStorageTileSide));
+      }
+    }
+  }
+
+  /**
+   * Replaces the whole ocean with the given cells as of the given
+   * iteration, and rebuilds the terrain wheel from their due ticks.
+   */
+  void loadState(uint64_t iteration, size_t noChange, const CellState* cells, size_t count) {
+    ChangeLog& log = scratch[0].log;
+    for (size_t k = 1; k < static_cast<size_t>(Species::Count); ++k) {
+      const CreaturePool& p = field.pool(static_cast<Species>(k));
+      std::vector<size_t> occupied;
+      for (uint32_t i : p.liveSlots) {
+        occupied.push_back(p.cell[i]);
+      }
+      for (size_t idx : occupied) {
+        field.clear(idx, log);
+      }
+    }
+    iterationCount = iteration;
+    noChangeCounter = noChange;
+    terrainWheel.reset(iteration);
+    for (size_t i = 0; i < count; ++i) {
+      const CellState& c = cells[i];
+      field.load(c, log);
+      Species k = static_cast<Species>(c.kind);
+      if (k == Species::Stone || k == Species::Reef) {
+        TimerWheel::Entry e = {c.dueTick, static_cast<size_t>(c.idx), field.slotAt(c.idx)};
+        terrainWheel.schedule(e);
+      }
+    }
+    collectChanges();
+    lastStorm = StormEvent();
+  }
+
+  /**
+   * Writes the iteration just finished to the recorder: the new contents
+   * of the changed cells and of the creatures that changed their own
+   * record, and the whole ocean every few ticks.
+   */
+  void recordTick() {
+    OCEAN_PROFILE_PHASE(profiler, Phase::Output);
+    TickRecord& r = recordScratch;
+    r.noChangeCounter = noChangeCounter;
+    r.events = lastEvents;
+    r.storm = lastStorm;
+    r.cells.clear();
+    for (size_t idx : recordCells) {
+      r.cells.push_back(field.save(idx));
+    }
+    recorder->writeTick(iterationCount, r);
+    if (iterationCount % recorder->keyframeEvery() == 0) {
+      r.cells.clear();
+      forEachCell([&r](const CellState& c) { r.cells.push_back(c); });
+      recorder->writeKeyframe(iterationCount, noChangeCounter, r.cells);
+    }
+  }
+
+  /**
+   * Hands the statistics of the iteration just finished to the series
+   * writer. The means are taken over the live slots of each pool.
+   */
+  void exportTick() {
+    OCEAN_PROFILE_PHASE(profiler, Phase::Output);
+    SeriesRow r;
+    r.tick = iterationCount;
+    r.population = population();
+    r.events = lastEvents;
+    r.storm = lastStorm;
+    r.meanAge.fill(0);
+    r.meanHunger.fill(0);
+    for (size_t k = static_cast<size_t>(Species::Prey); k < r.meanAge.size(); ++k) {
+      const CreaturePool& p = field.pools[k];
+      if (p.liveSlots.empty()) continue;
+      int64_t age = 0;
+      int64_t hunger = 0;
+      for (uint32_t i : p.liveSlots) {
+        age += p.age[i];
+        hunger += p.hunger[i];
+      }
+      r.meanAge[k] = static_cast<double>(age) / p.liveSlots.size();
+      r.meanHunger[k] = static_cast<double>(hunger) / p.liveSlots.size();
+    }
+    series->append(r);
+  }
+
+  /**
+   * Redoes a recorded tick. Aging is the only change a tick makes to a
+   * creature without logging its cell, so it is run again; every logged
+   * cell then takes its recorded contents.
+   */
+  /**
+   * Keeps what undoing the tick of r, about to be replayed, will need.
+   */
+  void saveReplayUndo(const TickRecord& r) {
+    ReplayUndo u;
+    u.noChangeCounter = noChangeCounter;
+    u.changeCount = lastChangeCount;
+    u.events = lastEvents;
+    u.storm = lastStorm;
+    const Species creatures[] = {Species::Prey, Species::Predator, Species::ApexPredator};
+    for (Species k : creatures) {
+      const CreaturePool& p = field.pool(k);
+      for (uint32_t i : p.liveSlots) {
+        u.cells.push_back(field.save(p.cell[i]));
+      }
+    }
+    for (const CellState& c : r.cells) {
+      u.cells.push_back(field.save(c.idx));
+    }
+    replayUndoBytes += u.cells.size() * sizeof(CellState);
+    replayUndo.push_back(std::move(u));
+    while (replayUndoBytes > kReplayUndoBytes && replayUndo.size() > 1) {
+      replayUndoBytes -= replayUndo.front().cells.size() * sizeof(CellState);
+      replayUndo.pop_front();
+    }
+  }
+
+  /**
+   * Takes the ocean back to the iteration before the current one.
+   */
+  void undoReplayTick() {
+    const ReplayUndo& u = replayUndo.back();
+    for (const CellState& c : u.cells) {
+      field.load(c, scratch[0].log);
+    }
+    collectChanges();
+    lastChangeCount = u.changeCount;
+    lastEvents = u.events;
+    lastStorm = u.storm;
+    iterationCount--;
+    noChangeCounter = u.noChangeCounter;
+    replayUndoBytes -= u.cells.size() * sizeof(CellState);
+    replayUndo.pop_back();
+  }
+
+  void replayTick(const TickRecord& r) {
+    ageCreatures();
+    for (const CellState& c : r.cells) {
+      field.load(c, scratch[0].log);
+    }
+    collectChanges();
+    lastEvents = r.events;
+    lastStorm = r.storm;
+    iterationCount++;
+    noChangeCounter = r.noChangeCounter;
+  }
+
+  /**
+   * Whether this process owns row x: always, unless the run is sharded.
+   */
+  bool ownsRow(size_t x) const {
+    return !shard || (x >= shard->x0 && x < shard->x1);
+  }
+
+  /**
+   * Whether this process keeps row x, owned or as a copy of a neighbour's.
+   */
+  bool holdsRow(size_t x) const {
+    return !shard ||
+           (x + rows + kHaloRows - shard->x0) % rows < shard->x1 - shard->x0 + 2 * kHaloRows;
+  }
+
+#ifdef _WIN32
+  void exchangeHalo(size_t) {}
+  size_t shardTotal(size_t n) { return n; }
+  void gatherShards() {}
+#else
+  /**
+   * Sends both neighbours the halo cells touched since the last exchange
+   * and applies theirs: writes into rows this shard owns, and fresh
+   * copies of their edge rows. Tiles of one phase never reach the same
+   * cell, so no cell is changed on both sides. A creature a neighbour
+   * moved into our band is queued for a later phase like any other cell
+   * gaining one. `phase` is the phase just processed, or kNoPhase.
+   */
+  void exchangeHalo(size_t phase) {
+    OCEAN_PROFILE_PHASE(profiler, Phase::Halo);
+    haloCells.clear();
+    for (WorkerScratch& ws : scratch) {
+      haloCells.insert(haloCells.end(), ws.log.halo.begin(), ws.log.halo.end());
+      ws.log.halo.clear();
+    }
+    std::sort(haloCells.begin(), haloCells.end());
+    haloCells.erase(std::unique(haloCells.begin(), haloCells.end()), haloCells.end());
+    haloOut[0].clear();
+    haloOut[1].clear();
+    for (size_t idx : haloCells) {
+      CellState s = field.save(idx);
+      std::vector<char>& out = haloOut[field.haloRows[idx / cols] - 1];
+      const char* bytes = reinterpret_cast<const char*>(&s);
+      out.insert(out.end(), bytes, bytes + sizeof(s));
+    }
+    int links[2] = {shard->up, shard->down};
+    exchangeMessages(links, haloOut, haloIn);
+
+    ChangeLog& log = scratch[0].log;
+    for (const std::vector<char>& in : haloIn) {
+      for (size_t at = 0; at + sizeof(CellState) <= in.size(); at += sizeof(CellState)) {
+        CellState s;
+        std::memcpy(&s, &in[at], sizeof(s));
+        field.load(s, log);
+        if (phase != kNoPhase && ownsRow(s.idx / cols) && isMobile(s.idx) &&
+            phaseOf(tileOf(s.idx)) > phase) {
+          enqueueAgent(s.idx);
+        }
+      }
+    }
+    // Not ours to send back
+    log.halo.clear();
+    reservePoolSpace();
+  }
+
+  /**
+   * Sum of n over all shards, known to every shard afterwards.
+   */
+  size_t shardTotal(size_t n) {
+    std::vector<char> message(sizeof(uint64_t));
+    uint64_t total = n;
+    if (shard->rank == 0) {
+      for (int fd : shard->workers) {
+        receiveMessage(fd, message);
+        uint64_t part;
+        std::memcpy(&part, message.data(), sizeof(part));
+        total += part;
+      }
+      std::memcpy(message.data(), &total, sizeof(total));
+      for (int fd : shard->workers) {
+        sendMessage(fd, message);
+      }
+    } else {
+      std::memcpy(message.data(), &total, sizeof(total));
+      sendMessage(shard->coordinator, message);
+      receiveMessage(shard->coordinator, message);
+      std::memcpy(&total, message.data(), sizeof(total));
+    }
+    return static_cast<size_t>(total);
+  }
+
+  /**
+   * Collects the whole ocean in rank 0 at the end of a sharded run: every
+   * other shard sends the cells it owns and the events of its last tick.
+   */
+  void gatherShards() {
+    const Species kinds[] = {Species::Stone, Species::Reef, Species::Prey,
+                             Species::Predator, Species::ApexPredator};
+    std::vector<char> message;
+    if (shard->rank != 0) {
+      message.resize(sizeof(TickEvents));
+      std::memcpy(message.data(), &lastEvents, sizeof(TickEvents));
+      for (Species k : kinds) {
+        for (uint32_t i : field.pool(k).liveSlots) {
+          size_t idx = field.pool(k).cell[i];
+          if (!ownsRow(idx / cols)) continue;
+          CellState s = field.save(idx);
+          const char* bytes = reinterpret_cast<const char*>(&s);
+          message.insert(message.end(), bytes, bytes + sizeof(s));
+        }
+      }
+      sendMessage(shard->coordinator, message);
+      return;
+    }
+    ChangeLog log;
+    for (Species k : kinds) {
+      std::vector<size_t> copies;
+      for (uint32_t i : field.pool(k).liveSlots) {
+        if (!ownsRow(field.pool(k).cell[i] / cols)) copies.push_back(field.pool(k).cell[i]);
+      }
+      for (size_t idx : copies) {
+        field.clear(idx, log);
+      }
+    }
+    for (int fd : shard->workers) {
+      receiveMessage(fd, message);
+      TickEvents events;
+      std::memcpy(&events, message.data(), sizeof(TickEvents));
+      lastEvents.add(events);
+      for (size_t at = sizeof(TickEvents); at + sizeof(CellState) <= message.size();
+           at += sizeof(CellState)) {
+        CellState s;
+        std::memcpy(&s, &message[at], sizeof(s));
+        field.load(s, log);
+      }
+    }
+    field.settle(log);
+  }
+#endif
+
+  /**
+   * Applies a storm. In a sharded run every shard applies it to its halo
+   * copies as well, which keeps them in step without an exchange; losses
+   * there are left for their owner to report.
+   */
+  void applyStorm(const Action& storm) {
+    OCEAN_PROFILE_PHASE(profiler, Phase::Storm);
+    OCEAN_PROFILE_COUNT(profiled(), actionsTried[Action::Storm], 1);
+    OCEAN_PROFILE_COUNT(profiled(), actionsApplied[Action::Storm], 1);
+    ChangeLog& log = scratch[0].log;
+    SpeciesCounts copies;
+    copies.fill(0);
+    if (shard) {
+      for (int i = -lastStorm.radius; i <= lastStorm.radius; ++i) {
+        size_t nx = wrap(static_cast<long long>(lastStorm.x) + i, rows);
+        if (ownsRow(nx)) continue;
+        for (int j = -lastStorm.radius; j <= lastStorm.radius; ++j) {
+          size_t ny = wrap(static_cast<long long>(lastStorm.y) + j, cols);
+          copies[static_cast<size_t>(field.kindAt(nx, ny))]++;
+        }
+      }
+    }
+    storm(field, rows, cols, log);
+    for (size_t k = 0; k < copies.size(); ++k) {
+      log.events.stormLosses[k] -= copies[k];
+    }
+    log.halo.clear();
+  }
+
+  /**
+   * Cuts the grid into tilesX x tilesY tiles, coloured for the phase
+   * schedule. Without a thread pool the whole grid is a single tile, which
+   * gives the plain row-by-row update order. Only the row and column
+   * boundaries are stored, so the schedule costs nothing for empty tiles.
+   */
+  void buildTiles(size_t tilesX, size_t tilesY) {
+    rowTile.resize(rows);
+    colTile.resize(cols);
+    rowInTile.resize(rows);
+    colInTile.resize(cols);
+    tilesPerRow = tilesY;
+    tilesPerCol = tilesX;
+    coloursY = tilesY % 2 == 1 && tilesY > 1 ? 3 : 2;
+    phaseAgents.clear();
+    phaseAgents.resize((tilesX % 2 == 1 && tilesX > 1 ? 3 : 2) * coloursY);
+    for (size_t tx = 0; tx < tilesX; ++tx) {
+      for (size_t i = tx * rows / tilesX; i < (tx + 1) * rows / tilesX; ++i) {
+        rowTile[i] = static_cast<uint32_t>(tx);
+        rowInTile[i] = static_cast<uint32_t>(i - tx * rows / tilesX);
+      }
+    }
+    for (size_t ty = 0; ty < tilesY; ++ty) {
+      for (size_t j = ty * cols / tilesY; j < (ty + 1) * cols / tilesY; ++j) {
+        colTile[j] = static_cast<uint32_t>(ty);
+        colInTile[j] = static_cast<uint32_t>(j - ty * cols / tilesY);
+      }
+    }
+    colBits = bitWidth((cols + tilesY - 1) / tilesY);
+    spanBits = colBits + bitWidth((rows + tilesX - 1) / tilesX);
+  }
+
+  /**
+   * Number of bits needed to store values below n.
+   */
+  static unsigned bitWidth(size_t n) {
+    unsigned bits = 0;
+    while ((size_t(1) << bits) < n) ++bits;
+    return bits;
+  }
+
+  /**
+   * Scheduling tile of a cell, numbered row-major.
+   */
+  size_t tileOf(size_t idx) const {
+    return static_cast<size_t>(rowTile[idx / cols]) * tilesPerRow + colTile[idx % cols];
+  }
+
+  /**
+   * Phase (colour) in which a scheduling tile is updated.
+   */
+  size_t phaseOf(size_t tile) const {
+    return tileColour(tile / tilesPerRow, tilesPerCol) * coloursY +
+           tileColour(tile % tilesPerRow, tilesPerRow);
+  }
+
+  /**
+   * Queues a visit to a cell in the phase of its tile.
+   */
+  void enqueueAgent(size_t idx) {
+    size_t x = idx / cols, y = idx % cols;
+    if (!ownsRow(x)) return;
+    size_t tile = static_cast<size_t>(rowTile[x]) * tilesPerRow + colTile[y];
+    AgentRef ref = {(uint64_t(tile) << spanBits) | (uint64_t(rowInTile[x]) << colBits) |
+                    colInTile[y], idx};
+    phaseAgents[phaseOf(tile)].push_back(ref);
+  }
+
+  /**
+   * Whether a cell holds a Prey, Predator or ApexPredator.
+   */
+  bool isMobile(size_t idx) const {
+    return field.kindAt(idx) >= Species::Prey;
+  }
+
+  /**
+   * Updates a cell holding a creature: clears it if the creature died,
+   * otherwise lets it act unless it already moved this turn. A creature
+   * that moved was aged before it did, so it is judged by its state after
+   * aging; the others by their state before.
+   */
+  void updateCell(size_t idx, WorkerScratch& ws) {
+    CellStore::CellRef cell = field.locate(idx);
+    Species k = cell.tile->kind[cell.offset];
+    CreaturePool& p = field.pool(k);
+    uint32_t i = cell.tile->slot[cell.offset];
+    bool moved = cell.tile->movedThisTurn[cell.offset];
+    // Born ahead of the sweep after the aging pass
+    if (!(p.flags[i] & kAged)) {
+      ageRecord(k, p, i);
+    }
+    // Replace dead object with Empty
+    if (p.flags[i] & (moved ? kDying : kDead)) {
+      ws.log.events.deaths[static_cast<size_t>(k)]++;
+      field.clear(idx, ws.log);
+      return;
+    }
+    if (!moved) {
+      OCEAN_PROFILE_VISIT(profiled(ws));
+      {
+        OCEAN_PROFILE_TIME(timed(ws), Phase::Decide);
+        decideActions(idx, k, i, ws);
+      }
+      OCEAN_PROFILE_TIME(timed(ws), Phase::Apply);
+      for (const Action& action : ws.actions) {
+        OCEAN_PROFILE_COUNT(profiled(ws), actionsTried[action.type], 1);
+        if (action(field, rows, cols, ws.log)) {
+          OCEAN_PROFILE_COUNT(profiled(ws), actionsApplied[action.type], 1);
+        }
+      }
+    }
+  }
+
+  /**
+   * Runs task(i, worker) for i in [0, count), on the pool if there is one.
+   */
+  template <typename F>
+  void runTasks(size_t count, F& task) {
+    if (pool) {
+      pool->run(count, task);
+    } else {
+      for (size_t i = 0; i < count; ++i) {
+        task(i, 0);
+      }
+    }
+  }
+
+  /**
+   * Transforms the stones and reefs whose countdown ends this tick. A
+   * storm may have wiped a cell since it was scheduled, so an entry only
+   * fires if the cell still holds the same record.
+   */
+  void updateTerrain() {
+    OCEAN_PROFILE_PHASE(profiler, Phase::Terrain);
+    dueTerrain.clear();
+    terrainWheel.advance(iterationCount, dueTerrain);
+    WorkerScratch& ws = scratch[0];
+    for (const TimerWheel::Entry& e : dueTerrain) {
+      Species k = field.kindAt(e.cell);
+      if ((k != Species::Stone && k != Species::Reef) || field.slotAt(e.cell) != e.slot ||
+          field.pool(k).dueTick[e.slot] != e.due) {
+        continue;
+      }
+      CellRng rng(seed, iterationCount, e.cell, RngStream::Terrain);
+      Species next = k == Species::Stone ? Species::Reef : Species::Stone;
+      spawn<Rules>(next, field, e.cell, rng, ws.log);
+      ws.log.events.transforms[static_cast<size_t>(next)]++;
+      scheduleTerrain(e.cell, next, iterationCount + 1);
+    }
+  }
+
+  /**
+   * Puts the transformation of the Stone or Reef in a cell on the wheel,
+   * given the first tick on which it is updated.
+   */
+  void scheduleTerrain(size_t idx, Species k, uint64_t firstTick) {
+    CreaturePool& p = field.pool(k);
+    uint32_t i = field.slotAt(idx);
+    p.dueTick[i] = firstTick + terrainUpdates(p.turnsToTransform[i]) - 1;
+    TimerWheel::Entry e = {p.dueTick[i], idx, i};
+    terrainWheel.schedule(e);
+  }
+
+  /**
+   * Puts every Stone and Reef of a new ocean on the wheel.
+   */
+  void scheduleAllTerrain() {
+    const Species terrain[] = {Species::Stone, Species::Reef};
+    for (Species k : terrain) {
+      for (uint32_t i : field.pool(k).liveSlots) {
+        size_t idx = field.pool(k).cell[i];
+        if (ownsRow(idx / cols)) scheduleTerrain(idx, k, 0);
+      }
+    }
+  }
+
+  /**
+   * Countdown of a Stone or Reef record as of the current tick, as if it
+   * were decremented on every update.
+   */
+  int32_t terrainCountdown(const CreaturePool& p, uint32_t i) const {
+    int64_t turns = p.turnsToTransform[i];
+    int64_t firstTick = static_cast<int64_t>(p.dueTick[i] - terrainUpdates(p.turnsToTransform[i])) + 1;
+    int64_t updates = std::max<int64_t>(0, static_cast<int64_t>(iterationCount) - firstTick);
+    return static_cast<int32_t>(std::max<int64_t>(0, turns - 2 * updates));
+  }
+
+  /**
+   * Ages record i of a creature species under Rules.
+   */
+  static void ageRecord(Species k, CreaturePool& p, size_t i) {
+    switch (k) {
+      case Species::Predator:     ::ageRecord<typename Rules::Predator>(p, i); break;
+      case Species::ApexPredator: ::ageRecord<typename Rules::ApexPredator>(p, i); break;
+      default:                    ::ageRecord<typename Rules::Prey>(p, i); break;
+    }
+  }
+
+  /**
+   * Aging kernel of a creature species under Rules.
+   */
+  static AgingKernel agingKernel(Species k) {
+    switch (k) {
+      case Species::Predator:     return ::agingKernel<typename Rules::Predator>();
+      case Species::ApexPredator: return ::agingKernel<typename Rules::ApexPredator>();
+      default:                    return ::agingKernel<typename Rules::Prey>();
+    }
+  }
+
+  /**
+   * Ages every creature at once before any of them acts, with the widest
+   * vector kernel available. A creature's own fields only change while it
+   * is updated, so doing this up front is indistinguishable from aging each
+   * one as the sweep reaches it.
+   */
+  void ageCreatures() {
+    OCEAN_PROFILE_PHASE(profiler, Phase::Aging);
+    const Species creatures[] = {Species::Prey, Species::Predator, Species::ApexPredator};
+    size_t chunks = pool ? pool->size() * 4 : 1;
+    for (Species k : creatures) {
+      CreaturePool& p = field.pool(k);
+      AgingKernel kernel = agingKernel(k);
+      size_t n = p.topSlot;
+      auto task = [&](size_t t, size_t) {
+        // Chunk edges on multiples of 8 keep every chunk on the vector path
+        size_t begin = t * n / chunks / 8 * 8;
+        size_t end = t + 1 == chunks ? n : (t + 1) * n / chunks / 8 * 8;
+        kernel(p, begin, end);
+      };
+      runTasks(chunks, task);
+    }
+  }
+
+  /**
+   * Visits the creatures, tile by tile and phase by phase. Only cells that
+   * hold a creature when the sweep reaches them are visited, in the same
+   * order as a full row-by-row pass over each tile would: the creatures
+   * present at the start of the tick, plus cells that gain one (a birth or
+   * a move) ahead of the sweep.
+   */
+  void updateAgents() {
+    const Species creatures[] = {Species::Prey, Species::Predator, Species::ApexPredator};
+    ageCreatures();
+    OCEAN_PROFILE_PHASE(profiler, Phase::Sweep);
+    for (Species k : creatures) {
+      const CreaturePool& p = field.pool(k);
+      for (uint32_t i : p.liveSlots) {
+        enqueueAgent(p.cell[i]);
+      }
+    }
+    for (size_t phase = 0; phase < phaseAgents.size(); ++phase) {
+      std::vector<AgentRef>& agents = phaseAgents[phase];
+      std::sort(agents.begin(), agents.end());
+      tileStarts.clear();
+      for (size_t i = 0; i < agents.size(); ++i) {
+        if (i == 0 || agents[i].order >> spanBits != agents[i - 1].order >> spanBits) {
+          tileStarts.push_back(i);
+        }
+      }
+      tileStarts.push_back(agents.size());
+      auto task = [&](size_t t, size_t worker) {
+        updateTile(&agents[tileStarts[t]], &agents[0] + tileStarts[t + 1], phase,
+                   scratch[worker]);
+      };
+      runTasks(tileStarts.size() - 1, task);
+      agents.clear();
+      for (WorkerScratch& ws : scratch) {
+        for (size_t idx : ws.deferred) {
+          enqueueAgent(idx);
+        }
+        ws.deferred.clear();
+      }
+      if (shard) exchangeHalo(phase);
+    }
+  }
+
+  /**
+   * Visits the creatures of one tile, given as a sorted run of visits, in
+   * row-major order.
+   */
+  void updateTile(const AgentRef* begin, const AgentRef* end, size_t phase, WorkerScratch& ws) {
+    size_t tile = begin->order >> spanBits;
+    std::greater<size_t> later;
+    ws.ahead.clear();
+    const AgentRef* next = begin;
+    size_t last = 0;
+    bool first = true;
+    while (next != end || !ws.ahead.empty()) {
+      size_t idx;
+      if (ws.ahead.empty() || (next != end && next->cell <= ws.ahead.front())) {
+        idx = (next++)->cell;
+      } else {
+        std::pop_heap(ws.ahead.begin(), ws.ahead.end(), later);
+        idx = ws.ahead.back();
+        ws.ahead.pop_back();
+      }
+      if (!first && idx == last) continue;
+      first = false;
+      last = idx;
+      if (!isMobile(idx)) continue;
+
+      size_t mark = ws.log.cells.size();
+      updateCell(idx, ws);
+      // Cells only gain creatures ahead of the sweep, and a cell is logged
+      // the first time it changes, so this sees every cell to revisit.
+      for (size_t i = mark; i < ws.log.cells.size(); ++i) {
+        size_t c = ws.log.cells[i];
+        if (!isMobile(c)) continue;
+        size_t t = tileOf(c);
+        if (t == tile) {
+          if (c > idx) {
+            ws.ahead.push_back(c);
+            std::push_heap(ws.ahead.begin(), ws.ahead.end(), later);
+          }
+        } else if (phaseOf(t) > phase) {
+          ws.deferred.push_back(c);
+        }
+      }
+    }
+  }
+
+  /**
+   * Random stream of the object acting in a cell during this iteration.
+   */
+  CellRng actRng(size_t idx) const {
+    return CellRng(seed, iterationCount, idx, RngStream::Act);
+  }
+
+  /**
+   * Whether the run is over: stable, or at the iteration limit. A
+   * restored ocean may already be.
+   */
+  bool finished() const { return isStable() || iterationCount >= maxIterations; }
+
+  /**
+   * Fills a cell with a random object (Empty, Stone, Reef, Prey, Predator,
+   * ApexPredator) following the probabilities of the species mix.
+   */
+  void randomObject(size_t idx) {
+    CellRng rng(seed, 0, idx, RngStream::Init);
+    int r = rng.below(100);
+    size_t k = 0;
+    for (int bound = mix.percent[0];
+         k + 1 < static_cast<size_t>(Species::Count) && r >= bound;
+         bound += mix.percent[++k]) {
+    }
+    spawn<Rules>(static_cast<Species>(k), field, idx, rng, scratch[0].log);
+  }
+
+  /**
+   * Makes sure every pool can serve this iteration's allocations from its
+   * free list without growing: a creature gives birth at most once per
+   * iteration, and a Stone or Reef turns into the other at most once.
+   */
+  void reservePoolSpace() {
+    OCEAN_PROFILE_PHASE(profiler, Phase::Reserve);
+    const Species creatures[] = {Species::Prey, Species::Predator, Species::ApexPredator};
+    for (Species k : creatures) {
+      field.pool(k).reserveSpare(field.pool(k).live);
+    }
+    field.pool(Species::Stone).reserveSpare(field.pool(Species::Reef).live);
+    field.pool(Species::Reef).reserveSpare(field.pool(Species::Stone).live);
+  }
 
   /**
-   * Creates a random object (Empty, Stone, Reef, Prey, Predator, ApexPredator)
-   * with adjusted probabilities.
-   */
-  std::shared_ptr<Object> randomObject() {
-    int r = rand() % 100;
-    if (r < 40) {
-      return std::make_shared<Empty>();
-    } else if (r < 50) {
-      return std::make_shared<Stone>();
-    } else if (r < 60) {
-      return std::make_shared<Reef>();
-    } else if (r < 80) {
-      return std::make_shared<Prey>();
-    } else if (r < 95) {
-      return std::make_shared<Predator>();
+   * Draws the stats and the part of the ocean in the viewport, sized to
+   * the terminal, followed by the storm of the last iteration, if any, and
+   * `footer`.
+   */
+  void display(const char* footer) {
+    OCEAN_PROFILE_PHASE(profiler, Phase::Render);
+    OCEAN_PROFILE_COUNT(profiled(), frames, 1);
+    status.str("");
+    printStats(status);
+    status << "\nIteration: " << iterationCount
+           << "  (No change counter: " << noChangeCounter << ")  Seed: " << seed << "\n";
+    size_t lines, columns;
+    terminalSize(lines, columns);
+    // Room for the view line, the storm line and the footer
+    std::string stats = status.str();
+    size_t headerLines = static_cast<size_t>(std::count(stats.begin(), stats.end(), '\n'));
+    size_t height = lines > headerLines + 5 ? lines - headerLines - 5 : 1;
+    size_t width = std::max<size_t>(1, columns / 2);
+    if (view.zoom == 0) {
+      view.zoom = 1;
+      while ((rows + view.zoom - 1) / view.zoom > height ||
+             (cols + view.zoom - 1) / view.zoom > width) {
+        view.zoom *= 2;
+      }
+    }
+    size_t z = view.zoom;
+    size_t viewRows = std::min(height, (rows + z - 1) / z);
+    size_t viewCols = std::min(width, (cols + z - 1) / z);
+    // An axis shown whole starts at 0, so that no block wraps onto another
+    if (viewRows * z >= rows) view.x = 0;
+    if (viewCols * z >= cols) view.y = 0;
+    status << "View: rows " << view.x << "+" << std::min(rows, viewRows * z)
+           << ", columns " << view.y << "+" << std::min(cols, viewCols * z) << ", 1:" << z
+           << (z == 1 ? "" : view.density ? " creature density" : " dominant species")
+           << "  [arrows/WASD scroll, +/- zoom, M mode, Q quit]\n";
+    std::string header = status.str();
+
+    status.str("");
+    if (lastStorm.occurred) {
+      status << ">>> Storm occurred around (" << lastStorm.x << ", " << lastStorm.y
+             << ") with radius " << lastStorm.radius << "!\n";
+    }
+    status << footer;
+    if (z == 1) {
+      renderer.draw(header, viewRows, viewCols,
+                    [this](size_t i, size_t j) {
+                      return field.kindAt((view.x + i) % rows, (view.y + j) % cols);
+                    },
+                    [](uint8_t k) { return kSpeciesInfo[k].symbol; }, status.str());
+    } else if (view.density) {
+      renderer.draw(header, viewRows, viewCols,
+                    [this](size_t i, size_t j) { return densityLevel(blockCounts(i, j)); },
+                    &densityGlyph, status.str());
     } else {
-      return std::make_shared<ApexPredator>();
+      renderer.draw(header, viewRows, viewCols,
+                    [this](size_t i, size_t j) { return dominantSpecies(blockCounts(i, j)); },
+                    [](uint8_t k) { return kSpeciesInfo[k].symbol; }, status.str());
+    }
+  }
+
+  /**
+   * Species of each kind in the block of cells behind character (i, j)
+   * of a zoomed-out view, with wrap-around; the last block of an axis
+   * shown whole stops at the edge.
+   */
+  SpeciesCounts blockCounts(size_t i, size_t j) const {
+    SpeciesCounts counts;
+    counts.fill(0);
+    size_t z = view.zoom;
+    size_t x = (view.x + i * z) % rows, y = (view.y + j * z) % cols;
+    size_t h = std::min(z, view.x == 0 ? rows - i * z : rows);
+    size_t w = std::min(z, view.y == 0 ? cols - j * z : cols);
+    // Split at the edges of the grid
+    size_t h0 = std::min(h, rows - x), w0 = std::min(w, cols - y);
+    field.countBlock(x, y, h0, w0, counts);
+    if (h0 < h) field.countBlock(0, y, h - h0, w0, counts);
+    if (w0 < w) field.countBlock(x, 0, h0, w - w0, counts);
+    if (h0 < h && w0 < w) field.countBlock(0, 0, h - h0, w - w0, counts);
+    counts[0] = h * w;
+    for (size_t k = 1; k < counts.size(); ++k) {
+      counts[0] -= counts[k];
+    }
+    return counts;
+  }
+
+  /**
+   * Most frequent non-empty species of a block, creatures winning ties;
+   * Empty if the block is.
+   */
+  static Species dominantSpecies(const SpeciesCounts& counts) {
+    size_t best = 0;
+    for (size_t k = 1; k < counts.size(); ++k) {
+      if (counts[k] > 0 && (best == 0 || counts[k] >= counts[best])) best = k;
+    }
+    return static_cast<Species>(best);
+  }
+
+  /**
+   * Density glyph of a block: none, under 1/8, 1/4, 1/2 of its cells
+   * holding a creature, or more.
+   */
+  static uint8_t densityLevel(const SpeciesCounts& counts) {
+    size_t cells = 0, creatures = 0;
+    for (size_t k = 0; k < counts.size(); ++k) {
+      cells += counts[k];
+      if (k >= static_cast<size_t>(Species::Prey)) creatures += counts[k];
+    }
+    if (creatures == 0) return 0;
+    if (creatures * 8 < cells) return 1;
+    if (creatures * 4 < cells) return 2;
+    if (creatures * 2 < cells) return 3;
+    return 4;
+  }
+
+  /**
+   * Applies a key to the viewport. Returns false for Quit.
+   */
+  bool handleKey(Key key) {
+    size_t lines, columns;
+    terminalSize(lines, columns);
+    // A quarter of the screen
+    size_t stepX = std::max<size_t>(1, lines / 4) * view.zoom % rows;
+    size_t stepY = std::max<size_t>(1, columns / 8) * view.zoom % cols;
+    switch (key) {
+      case Key::Up: view.x = (view.x + rows - stepX) % rows; break;
+      case Key::Down: view.x = (view.x + stepX) % rows; break;
+      case Key::Left: view.y = (view.y + cols - stepY) % cols; break;
+      case Key::Right: view.y = (view.y + stepY) % cols; break;
+      case Key::ZoomIn: view.zoom = std::max<size_t>(1, view.zoom / 2); break;
+      case Key::ZoomOut:
+        if (view.zoom < std::max(rows, cols)) view.zoom *= 2;
+        break;
+      case Key::Mode: view.density = !view.density; break;
+      case Key::Quit: return false;
+      case Key::None: break;
     }
+    return true;
   }
 
   /**
-   * Renders the ocean to the console.
+   * Prints how many of each type of object are present in the ocean, the
+   * births, deaths and kills of the last iteration, and the memory
+   * footprint of the cell store.
    */
-  void display() {
-    std::cout << "Iteration: " << iterationCount
-              << "  (No change counter: " << noChangeCounter << ") \n";
-    for (size_t i = 0; i < rows; ++i) {
-      for (size_t j = 0; j < cols; ++j) {
-        std::cout << field[i * cols + j]->getSymbol();
+  void printStats(std::ostream& out) const {
+    OceanStats s = stats();
+
+    out << "----- Ocean Statistics -----\n";
+    for (size_t k = 0; k < static_cast<size_t>(Species::Count); ++k) {
+      out << kSpeciesInfo[k].name << ": " << s.population[k];
+      if (k >= static_cast<size_t>(Species::Prey)) {
+        out << "  (+" << s.lastTick.births[k] << " -" << s.lastTick.deaths[k]
+            << " eaten " << s.lastTick.eaten[k] << ", kills " << s.lastTick.kills[k] << ")";
       }
-      std::cout << "\n";
+      out << "\n";
+    }
+    out << "Memory: " << CellStore::bytesPerCell() << " bytes/cell, "
+        << s.liveTiles << " live tiles, "
+        << (field.tileBytes() + field.poolBytes()) / 1024 << " KiB total\n";
+    out << "Pools (live / high-water / capacity):\n";
+    for (size_t k = 1; k < static_cast<size_t>(Species::Count); ++k) {
+      const CreaturePool& p = field.pools[k];
+      out << "  " << kSpeciesInfo[k].name << ": " << p.live << " / "
+          << p.highWater << " / " << p.capacity() << "\n";
     }
-    std::cout << std::flush;
   }
 
+  typedef void (Ocean::*DecideFn)(size_t idx, uint32_t me, WorkerScratch& ws);
+
   /**
-   * Prints how many of each type of object are present in the ocean.
+   * Per-species behaviour, indexed by Species.
    */
-  void printStats() {
-    std::map<std::string,int> counts;
-    for (auto& obj : field) {
-      counts[obj->getSymbol()]++;
-    }
+  static const DecideFn kDecide[static_cast<size_t>(Species::Count)];
 
-    auto nameOf = [&](const std::string& sym) {
-      if (sym == "  ")  return "Empty";
-      if (sym == "S ")  return "Stone";
-      if (sym == "R ")  return "Reef";
-      if (sym == "~ ")  return "Prey";
-      if (sym == "P ")  return "Predator";
-      if (sym == "A ")  return "ApexPredator";
-      return "Unknown";
-    };
-
-    std::cout << "----- Ocean Statistics -----\n";
-    for (auto& kv : counts) {
-      std::cout << nameOf(kv.first) << ": " << kv.second << "\n";
+  /**
+   * Decides what actions the object in a cell, of species k and record
+   * slot `me`, should take based on its local environment, and writes them
+   * into ws.actions.
+   */
+  void decideActions(size_t idx, Species k, uint32_t me, WorkerScratch& ws) {
+    ws.actions.clear();
+    if (field.pool(k).flags[me] & kDying) {
+      return;
     }
+    (this->*kDecide[static_cast<size_t>(k)])(idx, me, ws);
   }
 
   /**
-   * Decides what actions an object should take based on its type
-   * and local environment.
+   * Empty cells do nothing.
    */
-  std::vector<ActionWrapper> decideActions(std::shared_ptr<Object> obj) {
-    std::vector<ActionWrapper> actions;
-    if (obj->getSymbol() == "  " || !obj->isAlive()) {
-      actions.emplace_back(std::make_shared<NoAction>(obj));
-      return actions;
-    }
+  void decideIdle(size_t, uint32_t, WorkerScratch&) {
+  }
 
-    // Prey
-    if (auto prey = std::dynamic_pointer_cast<Prey>(obj)) {
-      auto neighbours = getNeighbours(obj->x, obj->y, 1);
-      bool dangerNearby = false;
-      std::pair<int,int> runDir = {0,0};
-      for (auto& n : neighbours) {
-        auto s = n->getSymbol();
-        if (s == "P " || s == "A ") {
-          dangerNearby = true;
-          runDir = getOppositeDirection(obj->x, obj->y, n->x, n->y);
-          break;
-        }
-      }
-      if (dangerNearby) {
-        actions.emplace_back(std::make_shared<MoveAction>(obj, runDir.first, runDir.second));
-      } else {
-        if (prey->canReproduce()) {
-          for (auto& n : neighbours) {
-            if (n->getSymbol() == "  ") {
-              size_t idx = n->x * cols + n->y;
-              auto baby = std::make_shared<Prey>();
-              baby->x = n->x;
-              baby->y = n->y;
-              field[idx] = baby;
-              prey->resetReproduce();
-              break;
-            }
-          }
-        }
-        auto d = randomDirection(1);
-        actions.emplace_back(std::make_shared<MoveAction>(obj, d.first, d.second));
-      }
-    }
-    // Predator
-    else if (auto predator = std::dynamic_pointer_cast<Predator>(obj)) {
-      auto neighbours = getNeighbours(obj->x, obj->y, 1);
-      bool apexNearby = false;
-      std::pair<int,int> runDir = {0,0};
-      for (auto& n : neighbours) {
-        if (n->getSymbol() == "A ") {
-          apexNearby = true;
-          runDir = getOppositeDirection(obj->x, obj->y, n->x, n->y);
-          break;
+  /**
+   * Prey flees from any predator next to it; otherwise it reproduces
+   * into a free neighbouring cell and wanders.
+   */
+  void decidePrey(size_t idx, uint32_t me, WorkerScratch& ws) {
+    CellRng rng = actRng(idx);
+    CreaturePool& self = field.pool(Species::Prey);
+    size_t x = idx / cols;
+    size_t y = idx % cols;
+    size_t threat = firstNeighbour(x, y, 1, speciesBit(Species::Predator) |
+                                            speciesBit(Species::ApexPredator), ws);
+    if (threat != kNoCell) {
+      auto runDir = getOppositeDirection(x, y, threat / cols, threat % cols);
+      ws.actions.push_back(Action::move(idx, runDir.first, runDir.second));
+    } else {
+      if (Prey<Rules>::canReproduce(self, me)) {
+        size_t n = firstNeighbour(x, y, 1, speciesBit(Species::Empty), ws);
+        if (n != kNoCell) {
+          Prey<Rules>::spawn(field, n, rng, ws.log);
+          ws.log.events.births[static_cast<size_t>(Species::Prey)]++;
+          Prey<Rules>::resetReproduce(self, me, rng);
+          noteRecord(idx, ws);
         }
       }
-      if (apexNearby) {
-        actions.emplace_back(std::make_shared<MoveAction>(obj, runDir.first, runDir.second));
+      auto d = randomDirection(1, rng);
+      ws.actions.push_back(Action::move(idx, d.first, d.second));
+    }
+  }
+
+  /**
+   * Predator runs from apex predators, otherwise hunts adjacent prey,
+   * roams (faster when hungry) and reproduces.
+   */
+  void decidePredator(size_t idx, uint32_t me, WorkerScratch& ws) {
+    CellRng rng = actRng(idx);
+    CreaturePool& self = field.pool(Species::Predator);
+    size_t x = idx / cols;
+    size_t y = idx % cols;
+    size_t threat = firstNeighbour(x, y, 1, speciesBit(Species::ApexPredator), ws);
+    if (threat != kNoCell) {
+      auto runDir = getOppositeDirection(x, y, threat / cols, threat % cols);
+      ws.actions.push_back(Action::move(idx, runDir.first, runDir.second));
+      return;
+    }
+    bool ate = false;
+    size_t prey = firstNeighbour(x, y, 1, speciesBit(Species::Prey), ws);
+    if (prey != kNoCell) {
+      auto dir = getDirection(x, y, prey / cols, prey % cols);
+      ws.actions.push_back(Action::eat(idx, dir.first, dir.second));
+      Predator<Rules>::feed(self, me);
+      noteRecord(idx, ws);
+      ate = true;
+    }
+    if (!ate) {
+      if (Predator<Rules>::isHungry(self, me)) {
+        auto d = randomDirection(2, rng);
+        ws.actions.push_back(Action::move(idx, d.first, d.second));
       } else {
-        bool ate = false;
-        for (auto& n : neighbours) {
-          if (n->getSymbol() == "~ ") {
-            auto dir = getDirection(obj->x, obj->y, n->x, n->y);
-            actions.emplace_back(std::make_shared<EatAction>(obj, dir.first, dir.second));
-            predator->feed();
-            ate = true;
-            break;
-          }
-        }
-        if (!ate) {
-          if (predator->isHungry()) {
-            auto d = randomDirection(2);
-            actions.emplace_back(std::make_shared<MoveAction>(obj, d.first, d.second));
-          } else {
-            auto d = randomDirection(1);
-            actions.emplace_back(std::make_shared<MoveAction>(obj, d.first, d.second));
-          }
-        }
-        if (predator->canReproduce()) {
-          for (auto& n : neighbours) {
-            if (n->getSymbol() == "  ") {
-              size_t idx = n->x * cols + n->y;
-              auto baby = std::make_shared<Predator>();
-              baby->x = n->x;
-              baby->y = n->y;
-              field[idx] = baby;
-              predator->resetReproduce();
-              break;
-            }
-          }
-        }
+        auto d = randomDirection(1, rng);
+        ws.actions.push_back(Action::move(idx, d.first, d.second));
       }
     }
-    // ApexPredator
-    else if (auto apex = std::dynamic_pointer_cast<ApexPredator>(obj)) {
-      auto neighbours = getNeighbours(obj->x, obj->y, apex->speed);
-      bool ate = false;
-      for (auto& n : neighbours) {
-        if (n->getSymbol() == "~ ") {
-          auto dir = getDirection(obj->x, obj->y, n->x, n->y);
-          actions.emplace_back(std::make_shared<EatAction>(obj, dir.first, dir.second));
-          apex->feed();
-          ate = true;
-          break;
-        }
-      }
-      // If still hungry, can eat Predator if speed=3
-      if (!ate && apex->canEatPredator()) {
-        for (auto& n : neighbours) {
-          if (n->getSymbol() == "P ") {
-            auto dir = getDirection(obj->x, obj->y, n->x, n->y);
-            actions.emplace_back(std::make_shared<EatAction>(obj, dir.first, dir.second));
-            apex->feed();
-            ate = true;
-            break;
-          }
-        }
-      }
-      if (!ate) {
-        auto d = randomDirection(apex->speed);
-        actions.emplace_back(std::make_shared<MoveAction>(obj, d.first, d.second));
-      }
-      if (apex->canReproduce()) {
-        for (auto& n : neighbours) {
-          if (n->getSymbol() == "  ") {
-            size_t idx = n->x * cols + n->y;
-            auto baby = std::make_shared<ApexPredator>();
-            baby->x = n->x;
-            baby->y = n->y;
-            field[idx] = baby;
-            apex->resetReproduce();
-            break;
-          }
-        }
+    if (Predator<Rules>::canReproduce(self, me)) {
+      size_t n = firstNeighbour(x, y, 1, speciesBit(Species::Empty), ws);
+      if (n != kNoCell) {
+        Predator<Rules>::spawn(field, n, rng, ws.log);
+        ws.log.events.births[static_cast<size_t>(Species::Predator)]++;
+        Predator<Rules>::resetReproduce(self, me, rng);
+        noteRecord(idx, ws);
       }
     }
-    // Stone
-    else if (auto stone = std::dynamic_pointer_cast<Stone>(obj)) {
-      stone->tick();
-      if (stone->isReadyToTransform()) {
-        size_t idx = obj->x * cols + obj->y;
-        auto reef = std::make_shared<Reef>();
-        reef->x = obj->x;
-        reef->y = obj->y;
-        field[idx] = reef;
-      }
-      actions.emplace_back(std::make_shared<NoAction>(obj));
+  }
+
+  /**
+   * Apex predator hunts prey within its speed, predators as well when
+   * starving, and reproduces.
+   */
+  void decideApex(size_t idx, uint32_t me, WorkerScratch& ws) {
+    CellRng rng = actRng(idx);
+    CreaturePool& self = field.pool(Species::ApexPredator);
+    size_t x = idx / cols;
+    size_t y = idx % cols;
+    // Feeding resets the speed, the search range stays as it was
+    int range = self.speed[me];
+    bool ate = false;
+    size_t prey = firstNeighbour(x, y, range, speciesBit(Species::Prey), ws);
+    if (prey != kNoCell) {
+      auto dir = getDirection(x, y, prey / cols, prey % cols);
+      ws.actions.push_back(Action::eat(idx, dir.first, dir.second));
+      ApexPredator<Rules>::feed(self, me);
+      noteRecord(idx, ws);
+      ate = true;
     }
-    // Reef
-    else if (auto reef = std::dynamic_pointer_cast<Reef>(obj)) {
-      reef->tick();
-      if (reef->isReadyToTransform()) {
-        size_t idx = obj->x * cols + obj->y;
-        auto st = std::make_shared<Stone>();
-        st->x = obj->x;
-        st->y = obj->y;
-        field[idx] = st;
+    // If still hungry, can eat Predator if speed=3
+    if (!ate && ApexPredator<Rules>::canEatPredator(self, me)) {
+      size_t n = firstNeighbour(x, y, range, speciesBit(Species::Predator), ws);
+      if (n != kNoCell) {
+        auto dir = getDirection(x, y, n / cols, n % cols);
+        ws.actions.push_back(Action::eat(idx, dir.first, dir.second));
+        ApexPredator<Rules>::feed(self, me);
+        noteRecord(idx, ws);
+        ate = true;
       }
-      actions.emplace_back(std::make_shared<NoAction>(obj));
     }
-    else {
-      actions.emplace_back(std::make_shared<NoAction>(obj));
+    if (!ate) {
+      auto d = randomDirection(self.speed[me], rng);
+      ws.actions.push_back(Action::move(idx, d.first, d.second));
+    }
+    if (ApexPredator<Rules>::canReproduce(self, me)) {
+      size_t n = firstNeighbour(x, y, range, speciesBit(Species::Empty), ws);
+      if (n != kNoCell) {
+        ApexPredator<Rules>::spawn(field, n, rng, ws.log);
+        ws.log.events.births[static_cast<size_t>(Species::ApexPredator)]++;
+        ApexPredator<Rules>::resetReproduce(self, me, rng);
+        noteRecord(idx, ws);
+      }
     }
+  }
 
-    return actions;
+  /**
+   * Notes that the creature in a cell changed its own record, for the
+   * recorder; such changes do not count as changes of the cell.
+   */
+  void noteRecord(size_t idx, WorkerScratch& ws) {
+    if (recorder) ws.log.records.push_back(idx);
   }
 
+  static unsigned speciesBit(Species k) { return 1u << static_cast<unsigned>(k); }
+
   /**
-   * Returns neighbors in a square radius (toroidal wrapping).
+   * First cell in a square radius around (x, y) (toroidal wrapping) that
+   * holds one of the species in `species` (a set of speciesBit() values),
+   * or kNoCell. Cells are searched row by row from -range to range, and
+   * left to right within a row, skipping (x, y) itself. Each row is a
+   * single read from the bitplanes unless the square wraps sideways. The
+   * cells looked at are counted in ws when profiling.
    */
-  std::vector<std::shared_ptr<Object>> getNeighbours(size_t x, size_t y, int range) {
-    std::vector<std::shared_ptr<Object>> neighbours;
+  size_t firstNeighbour(size_t x, size_t y, int range, unsigned species,
+                        WorkerScratch& ws) const {
+    OCEAN_PROFILE_TIME(timed(ws), Phase::Neighbours);
+    int width = 2 * range + 1;
+    size_t r = static_cast<size_t>(range);
+    bool inside = y >= r && y + r < cols;
+    CellStore::WindowReader window(field, species, inside ? y - r : 0, width);
     for (int dx = -range; dx <= range; ++dx) {
-      for (int dy = -range; dy <= range; ++dy) {
-        if (dx == 0 && dy == 0) continue;
-        size_t nx = (x + dx + rows) % rows;
-        size_t ny = (y + dy + cols) % cols;
-        neighbours.push_back(field[nx * cols + ny]);
+      OCEAN_PROFILE_COUNT(profiled(ws), neighbourCells, width);
+      size_t nx = wrap(static_cast<long long>(x) + dx, rows);
+      uint64_t bits = 0;
+      if (inside) {
+        bits = window.read(nx);
+      } else {
+        for (int dy = -range; dy <= range; ++dy) {
+          size_t ny = wrap(static_cast<long long>(y) + dy, cols);
+          if (species & speciesBit(field.kindAt(nx, ny))) {
+            bits |= uint64_t(1) << (dy + range);
+          }
+        }
+      }
+      if (dx == 0) {
+        bits &= ~(uint64_t(1) << range);
+      }
+      if (bits) {
+        long long dy = lowestBit(bits) - range;
+        return nx * cols + wrap(static_cast<long long>(y) + dy, cols);
       }
     }
-    return neighbours;
+    return kNoCell;
   }
 
   /**
    * Returns a random direction (dx, dy) with the given step size.
    */
-  std::pair<int,int> randomDirection(int step) {
-    int d = rand() % 4;
+  std::pair<int,int> randomDirection(int step, CellRng& rng) {
+    int d = rng.below(4);
     int dx = 0, dy = 0;
     if (d == 0) dx = -step;
     else if (d == 1) dx = step;
@@ -821,44 +5871,873 @@ private:
   }
 
   /**
-   * Creates a copy of the entire field (vector of shared_ptr).
+   * Gathers the change logs of all threads at the end of an iteration:
+   * counts the changed cells, optionally merges them into one sorted list,
+   * and resets the per-cell marks of exactly those cells.
    */
-  std::vector<std::shared_ptr<Object>> copyState() {
-    return field;
+  void collectChanges() {
+    OCEAN_PROFILE_PHASE(profiler, Phase::Settle);
+    lastChangeCount = 0;
+    lastEvents.reset();
+    changedList.clear();
+    recordCells.clear();
+    for (WorkerScratch& ws : scratch) {
+      if (shard) {
+        for (size_t idx : ws.log.cells) {
+          lastChangeCount += ownsRow(idx / cols);
+        }
+      } else {
+        lastChangeCount += ws.log.cells.size();
+      }
+      lastEvents.add(ws.log.events);
+      ws.log.events.reset();
+      if (trackChanges) {
+        changedList.insert(changedList.end(), ws.log.cells.begin(), ws.log.cells.end());
+      }
+      if (recorder) {
+        recordCells.insert(recordCells.end(), ws.log.records.begin(), ws.log.records.end());
+        ws.log.records.clear();
+      }
+      field.settle(ws.log);
+      ws.log.cells.clear();
+    }
+    if (trackChanges && scratch.size() > 1) {
+      std::sort(changedList.begin(), changedList.end());
+    }
+    if (recorder) {
+      recordCells.insert(recordCells.end(), changedList.begin(), changedList.end());
+      std::sort(recordCells.begin(), recordCells.end());
+      recordCells.erase(std::unique(recordCells.begin(), recordCells.end()), recordCells.end());
+    }
+    field.releaseIdleTiles();
+    if (shard) lastChangeCount = shardTotal(lastChangeCount);
+    assert(population() == recount());
   }
+};
 
-  /**
-   * Checks if the ocean changed compared to the old state.
-   * We look at pointer equality and symbol differences.
-   */
-  bool isChanged(const std::vector<std::shared_ptr<Object>>& oldS,
-                 const std::vector<std::shared_ptr<Object>>& newS) {
-    if (oldS.size() != newS.size()) return true;
-    for (size_t i = 0; i < oldS.size(); ++i) {
-      if (oldS[i].get() != newS[i].get()) return true;
-      if (oldS[i]->getSymbol() != newS[i]->getSymbol()) return true;
+template <class Rules>
+const typename Ocean<Rules>::DecideFn Ocean<Rules>::kDecide[static_cast<size_t>(Species::Count)] = {
+  &Ocean::decideIdle,      // Empty
+  &Ocean::decideIdle,      // Stone, transformed by updateTerrain()
+  &Ocean::decideIdle,      // Reef, transformed by updateTerrain()
+  &Ocean::decidePrey,      // Prey
+  &Ocean::decidePredator,  // Predator
+  &Ocean::decideApex,      // ApexPredator
+};
+
+// ------------------ benchmark ------------------
+
+/**
+ * Result of one benchmark case.
+ */
+struct BenchResult {
+  size_t size;
+  const char* mix;
+  size_t threads;
+  uint64_t seed;
+  size_t ticks;
+  double seconds;
+  double nsPerCellTick;
+  double ticksPerSecond;
+  double allocsPerTick;
+  size_t peakRssKb;
+};
+
+/**
+ * Runs a fixed-seed size x size ocean for the given number of ticks and
+ * measures the tick loop only (construction is excluded).
+ */
+template <class Rules>
+BenchResult benchCase(size_t size, const SpeciesMix& mix, uint64_t seed, size_t ticks,
+                      size_t threads) {
+  Ocean<Rules> ocean(size, size, seed, mix);
+  if (threads > 0) {
+    ocean.setThreads(threads);
+  }
+  ocean.setMaxIterations(static_cast<size_t>(-1));
+
+  uint64_t allocsBefore = gAllocationCount.load(std::memory_order_relaxed);
+  auto start = std::chrono::steady_clock::now();
+  for (size_t t = 0; t < ticks; ++t) {
+    ocean.step();
+  }
+  std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+  uint64_t allocs = gAllocationCount.load(std::memory_order_relaxed) - allocsBefore;
+
+  BenchResult r;
+  r.size = size;
+  r.mix = mix.name;
+  r.threads = threads;
+  r.seed = seed;
+  r.ticks = ticks;
+  r.seconds = elapsed.count();
+  r.nsPerCellTick = r.seconds * 1e9 / (static_cast<double>(size) * size * ticks);
+  r.ticksPerSecond = r.seconds > 0 ? ticks / r.seconds : 0.0;
+  r.allocsPerTick = static_cast<double>(allocs) / ticks;
+  r.peakRssKb = peakRssKb();
+  return r;
+}
+
+/**
+ * Runs every size/mix combination, prints a table and writes the results
+ * as JSON to outPath so that runs can be diffed between versions.
+ * When ticks is 0 the tick count is scaled so that each case simulates
+ * roughly the same number of cells. threads > 0 selects the tiled engine.
+ */
+template <class Rules>
+int runBenchmarks(const std::vector<size_t>& sizes, size_t ticks, size_t threads,
+                  const std::string& outPath) {
+  const uint64_t seed = 12345;
+  const SpeciesMix* mixes[] = {&kDefaultMix, &kPreyHeavyMix, &kApexHeavyMix};
+
+  std::vector<BenchResult> results;
+  std::printf("%-8s %-12s %8s %14s %12s %14s %14s\n",
+              "size", "mix", "ticks", "ns/cell/tick", "ticks/s", "allocs/tick", "peak RSS KiB");
+  for (size_t size : sizes) {
+    size_t caseTicks = ticks;
+    if (caseTicks == 0) {
+      caseTicks = std::max<size_t>(3, std::min<size_t>(500, 50000000 / (size * size)));
+    }
+    for (const SpeciesMix* mix : mixes) {
+      BenchResult r = benchCase<Rules>(size, *mix, seed, caseTicks, threads);
+      std::printf("%-8zu %-12s %8zu %14.2f %12.1f %14.1f %14zu\n",
+                  r.size, r.mix, r.ticks, r.nsPerCellTick, r.ticksPerSecond,
+                  r.allocsPerTick, r.peakRssKb);
+      results.push_back(r);
     }
-    return false;
   }
+
+  std::ofstream out(outPath.c_str());
+  if (!out) {
+    std::cerr << "Cannot write " << outPath << "\n";
+    return 1;
+  }
+  const char* kernelName = agingKernelName();
+  out << "{\n  \"rules\": \"" << ruleSetName(Rules::id) << "\""
+      << ",\n  \"bytes_per_cell\": " << CellStore::bytesPerCell()
+      << ",\n  \"aging_kernel\": \"" << kernelName << "\",\n  \"cases\": [\n";
+  for (size_t i = 0; i < results.size(); ++i) {
+    const BenchResult& r = results[i];
+    out << "    {\"size\": " << r.size << ", \"mix\": \"" << r.mix << "\""
+        << ", \"threads\": " << r.threads
+        << ", \"seed\": " << r.seed << ", \"ticks\": " << r.ticks
+        << ", \"seconds\": " << r.seconds
+        << ", \"ns_per_cell_tick\": " << r.nsPerCellTick
+        << ", \"ticks_per_second\": " << r.ticksPerSecond
+        << ", \"allocs_per_tick\": " << r.allocsPerTick
+        << ", \"peak_rss_kb\": " << r.peakRssKb << "}"
+        << (i + 1 < results.size() ? "," : "") << "\n";
+  }
+  out << "  ]\n}\n";
+  std::cout << "Results written to " << outPath << "\n";
+  return 0;
+}
+
+// ------------------ ensemble ------------------
+
+/**
+ * Outcome of one ocean of an ensemble.
+ */
+struct EnsembleRun {
+  const SpeciesMix* mix;
+  uint64_t seed;
+  size_t ticks;
+  bool stable;
+  double seconds;
+  uint64_t gridHash;
+  SpeciesCounts final;
+  SpeciesCounts peak;
+  SpeciesCounts peakTick;
+  // Tick on which the species died out, 0 if it survived
+  SpeciesCounts extinctionTick;
 };
 
+/**
+ * Runs one ocean of an ensemble to its end on the calling thread, watching
+ * the population after every tick. Everything it touches is its own, so
+ * any number of them can run at once.
+ */
+template <class Rules>
+EnsembleRun ensembleCase(size_t rows, size_t cols, const Area& populated, const SpeciesMix& mix,
+                         uint64_t seed, size_t ticks) {
+  auto start = std::chrono::steady_clock::now();
+  Ocean<Rules> ocean(rows, cols, seed, mix, populated);
+  ocean.setMaxIterations(ticks);
+  EnsembleRun r;
+  r.mix = &mix;
+  r.seed = seed;
+  r.peak = ocean.population();
+  r.peakTick.fill(0);
+  r.extinctionTick.fill(0);
+  bool running = true;
+  while (running) {
+    running = ocean.step();
+    OceanStats s = ocean.stats();
+    for (size_t k = 1; k < s.population.size(); ++k) {
+      if (s.population[k] > r.peak[k]) {
+        r.peak[k] = s.population[k];
+        r.peakTick[k] = s.iteration;
+      }
+      if (s.population[k] == 0 && r.peak[k] > 0 && r.extinctionTick[k] == 0) {
+        r.extinctionTick[k] = s.iteration;
+      }
+    }
+    r.ticks = s.iteration;
+  }
+  r.stable = ocean.isStable();
+  r.final = ocean.population();
+  r.gridHash = ocean.gridHash();
+  std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+  r.seconds = elapsed.count();
+  return r;
+}
+
+/**
+ * Writes ,"key":{"Species":n,...} for every species but Empty.
+ */
+void writeJsonSpecies(std::ostream& out, const char* key, const SpeciesCounts& counts) {
+  out << ", \"" << key << "\": {";
+  for (size_t k = 1; k < counts.size(); ++k) {
+    out << (k > 1 ? ", " : "") << "\"" << kSpeciesInfo[k].name << "\": " << counts[k];
+  }
+  out << "}";
+}
+
+/**
+ * Runs `runs` oceans per species mix, seeded seed, seed + 1, ..., on a
+ * pool of `threads` threads (0: one per core), one ocean per task. Prints
+ * a table per mix and writes every run's outcome as JSON to outPath.
+ */
+template <class Rules>
+int runEnsemble(size_t rows, size_t cols, const Area& populated,
+                const std::vector<const SpeciesMix*>& mixes, size_t runs, uint64_t seed,
+                size_t ticks, size_t threads, const std::string& outPath) {
+  if (threads == 0) {
+    threads = std::max(1u, std::thread::hardware_concurrency());
+  }
+  std::vector<EnsembleRun> results(mixes.size() * runs);
+  auto start = std::chrono::steady_clock::now();
+  {
+    WorkStealingPool pool(std::min(threads, results.size()));
+    auto task = [&](size_t i, size_t) {
+      results[i] = ensembleCase<Rules>(rows, cols, populated, *mixes[i / runs], seed + i % runs, ticks);
+    };
+    pool.run(results.size(), task);
+  }
+  std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+  const size_t prey = static_cast<size_t>(Species::Prey);
+  const size_t count = static_cast<size_t>(Species::Count);
+  std::printf("%-12s %6s %8s %10s", "mix", "runs", "stable", "mean ticks");
+  for (size_t k = prey; k < count; ++k) {
+    std::printf(" %12s", (std::string(kSpeciesInfo[k].name) + " alive").c_str());
+  }
+  std::printf("\n");
+  for (size_t m = 0; m < mixes.size(); ++m) {
+    size_t stable = 0;
+    double meanTicks = 0;
+    SpeciesCounts alive;
+    alive.fill(0);
+    for (size_t i = m * runs; i < (m + 1) * runs; ++i) {
+      stable += results[i].stable;
+      meanTicks += static_cast<double>(results[i].ticks) / runs;
+      for (size_t k = prey; k < count; ++k) {
+        alive[k] += results[i].final[k] > 0;
+      }
+    }
+    std::printf("%-12s %6zu %8zu %10.1f", mixes[m]->name, runs, stable, meanTicks);
+    for (size_t k = prey; k < count; ++k) {
+      std::printf(" %11.1f%%", 100.0 * alive[k] / runs);
+    }
+    std::printf("\n");
+  }
+  threads = std::min(threads, results.size());
+  std::printf("%zu runs on %zu thread%s in %.2f s (%.2f runs/s)\n", results.size(), threads,
+              threads == 1 ? "" : "s", elapsed.count(),
+              elapsed.count() > 0 ? results.size() / elapsed.count() : 0.0);
+
+  std::ofstream out(outPath.c_str());
+  if (!out) {
+    std::cerr << "Cannot write " << outPath << "\n";
+    return 1;
+  }
+  out << "{\n  \"rules\": \"" << ruleSetName(Rules::id) << "\""
+      << ", \"rows\": " << rows << ", \"cols\": " << cols << ", \"max_ticks\": " << ticks
+      << ", \"threads\": " << threads
+      << ", \"seconds\": " << elapsed.count() << ",\n  \"runs\": [\n";
+  for (size_t i = 0; i < results.size(); ++i) {
+    const EnsembleRun& r = results[i];
+    out << "    {\"mix\": \"" << r.mix->name << "\", \"seed\": " << r.seed
+        << ", \"ticks\": " << r.ticks << ", \"stop\": \"" << (r.stable ? "stable" : "limit") << "\""
+        << ", \"seconds\": " << r.seconds
+        << ", \"grid_hash\": \"" << std::hex << r.gridHash << std::dec << "\"";
+    writeJsonSpecies(out, "final", r.final);
+    writeJsonSpecies(out, "peak", r.peak);
+    writeJsonSpecies(out, "peak_tick", r.peakTick);
+    out << ", \"extinction_tick\": {";
+    for (size_t k = prey; k < count; ++k) {
+      out << (k > prey ? ", " : "") << "\"" << kSpeciesInfo[k].name << "\": ";
+      if (r.extinctionTick[k]) {
+        out << r.extinctionTick[k];
+      } else {
+        out << "null";
+      }
+    }
+    out << "}}" << (i + 1 < results.size() ? "," : "") << "\n";
+  }
+  out << "  ]\n}\n";
+  std::cout << "Results written to " << outPath << "\n";
+  return 0;
+}
+
 // ------------------ main ------------------
 
+/**
+ * Command-line options.
+ */
+struct Options {
+  size_t rows = 30;
+  size_t cols = 40;
+  bool headless = false;
+  uint64_t seed = 0;
+  bool seedGiven = false;
+  size_t threads = 0;
+  // Rule set of a new ocean; a restored or replayed one keeps its own
+  RuleSet rules = RuleSet::Classic;
+  // Processes of a sharded headless run; 0 means not sharded
+  size_t shards = 0;
+  size_t ticks = 5000;
+  // Checkpoint to write, how often, and checkpoint to resume from
+  std::string checkpoint;
+  size_t checkpointEvery = 500;
+  std::string restore;
+  // Recording to write and its keyframe interval
+  std::string record;
+  size_t keyframeEvery = 100;
+  // Per-iteration statistics to export
+  std::string series;
+  // Scenario to start from, and file to save the starting ocean to as one
+  std::string scenario;
+  std::string scenarioOut;
+  // Print a breakdown of where the time went at exit
+  bool profile = false;
+  // Recording to play, and the ticks to play it from and to
+  std::string replay;
+  uint64_t replayFrom = 0;
+  uint64_t replayTo = UINT64_MAX;
+  // Pause after every tick on screen, and the frame rate cap
+  int tickMs = 120;
+  double maxFps = 30;
+  // Part of the ocean shown first
+  Viewport view;
+  bool ticksGiven = false;
+  // Size of the block in the middle of the grid filled at start; 0 means
+  // the whole grid
+  size_t populateRows = 0;
+  size_t populateCols = 0;
+  bool bench = false;
+  std::vector<size_t> benchSizes = {64, 512, 4096};
+  std::string benchOut = "bench.json";
+  // Oceans per species mix of an ensemble; 0 means no ensemble
+  size_t ensemble = 0;
+  std::vector<const SpeciesMix*> ensembleMixes = {&kDefaultMix};
+  std::string ensembleOut = "ensemble.json";
+};
+
+/**
+ * Parses a comma separated list of sizes such as "64,512,4096".
+ */
+std::vector<size_t> parseSizeList(const char* text) {
+  std::vector<size_t> sizes;
+  std::stringstream ss(text);
+  std::string item;
+  while (std::getline(ss, item, ',')) {
+    size_t v = std::strtoul(item.c_str(), nullptr, 10);
+    if (v > 0) {
+      sizes.push_back(v);
+    }
+  }
+  return sizes;
+}
+
+/**
+ * Parses a comma separated list of species mix names such as
+ * "default,prey-heavy". Returns an empty list if a name is unknown.
+ */
+std::vector<const SpeciesMix*> parseMixList(const char* text) {
+  const SpeciesMix* known[] = {&kDefaultMix, &kPreyHeavyMix, &kApexHeavyMix};
+  std::vector<const SpeciesMix*> mixes;
+  std::stringstream ss(text);
+  std::string item;
+  while (std::getline(ss, item, ',')) {
+    const SpeciesMix* found = nullptr;
+    for (const SpeciesMix* m : known) {
+      if (item == m->name) found = m;
+    }
+    if (!found) return std::vector<const SpeciesMix*>();
+    mixes.push_back(found);
+  }
+  return mixes;
+}
+
+/**
+ * Parses a rule set name such as "harsh". Returns false if it is unknown.
+ */
+bool parseRuleSet(const char* text, RuleSet& rules) {
+  for (size_t r = 0; r < static_cast<size_t>(RuleSet::Count); ++r) {
+    if (std::strcmp(text, kRuleSetNames[r]) == 0) {
+      rules = static_cast<RuleSet>(r);
+      return true;
+    }
+  }
+  return false;
+}
+
+/**
+ * Parses "[rows cols] [--headless] [--ticks N] [--seed S] [--threads N]
+ * [--rules NAME] [--shards N] [--populate R C] [--scenario FILE]
+ * [--scenario-out FILE] [--checkpoint FILE [--checkpoint-every N]]
+ * [--restore FILE] [--record FILE [--keyframe-every N]] [--series FILE]
+ * [--profile] [--tick-ms N] [--fps N] [--view X Y] [--zoom Z] [--density]",
+ * the replay options "--replay FILE [--headless] [--from N] [--to N]" with
+ * the same display options, the ensemble options "--ensemble N
+ * [--ensemble-mixes default,prey-heavy] [--ensemble-out FILE]" and the
+ * benchmark options "--bench [--bench-sizes 64,512] [--bench-out FILE]".
+ * Returns false and prints usage on malformed input.
+ */
+bool parseOptions(int argc, char* argv[], Options& opts) {
+  std::vector<size_t> positional;
+  for (int i = 1; i < argc; ++i) {
+    if (std::strcmp(argv[i], "--headless") == 0) {
+      opts.headless = true;
+    } else if (std::strcmp(argv[i], "--ticks") == 0 && i + 1 < argc) {
+      opts.ticks = std::strtoul(argv[++i], nullptr, 10);
+      opts.ticksGiven = true;
+    } else if (std::strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+      opts.seed = std::strtoull(argv[++i], nullptr, 10);
+      opts.seedGiven = true;
+    } else if (std::strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+      opts.threads = std::strtoul(argv[++i], nullptr, 10);
+      if (opts.threads == 0) {
+        opts.rows = 0;
+        break;
+      }
+    } else if (std::strcmp(argv[i], "--rules") == 0 && i + 1 < argc) {
+      if (!parseRuleSet(argv[++i], opts.rules)) {
+        positional.clear();
+        opts.rows = 0;
+        break;
+      }
+    } else if (std::strcmp(argv[i], "--shards") == 0 && i + 1 < argc) {
+      opts.shards = std::strtoul(argv[++i], nullptr, 10);
+      if (opts.shards < 2) {
+        opts.rows = 0;
+        break;
+      }
+    } else if (std::strcmp(argv[i], "--checkpoint") == 0 && i + 1 < argc) {
+      opts.checkpoint = argv[++i];
+    } else if (std::strcmp(argv[i], "--checkpoint-every") == 0 && i + 1 < argc) {
+      opts.checkpointEvery = std::strtoul(argv[++i], nullptr, 10);
+    } else if (std::strcmp(argv[i], "--restore") == 0 && i + 1 < argc) {
+      opts.restore = argv[++i];
+    } else if (std::strcmp(argv[i], "--record") == 0 && i + 1 < argc) {
+      opts.record = argv[++i];
+    } else if (std::strcmp(argv[i], "--keyframe-every") == 0 && i + 1 < argc) {
+      opts.keyframeEvery = std::strtoul(argv[++i], nullptr, 10);
+    } else if (std::strcmp(argv[i], "--profile") == 0) {
+      opts.profile = true;
+    } else if (std::strcmp(argv[i], "--series") == 0 && i + 1 < argc) {
+      opts.series = argv[++i];
+    } else if (std::strcmp(argv[i], "--scenario") == 0 && i + 1 < argc) {
+      opts.scenario = argv[++i];
+    } else if (std::strcmp(argv[i], "--scenario-out") == 0 && i + 1 < argc) {
+      opts.scenarioOut = argv[++i];
+    } else if (std::strcmp(argv[i], "--replay") == 0 && i + 1 < argc) {
+      opts.replay = argv[++i];
+    } else if (std::strcmp(argv[i], "--from") == 0 && i + 1 < argc) {
+      opts.replayFrom = std::strtoull(argv[++i], nullptr, 10);
+    } else if (std::strcmp(argv[i], "--to") == 0 && i + 1 < argc) {
+      opts.replayTo = std::strtoull(argv[++i], nullptr, 10);
+    } else if (std::strcmp(argv[i], "--tick-ms") == 0 && i + 1 < argc) {
+      opts.tickMs = std::atoi(argv[++i]);
+    } else if (std::strcmp(argv[i], "--fps") == 0 && i + 1 < argc) {
+      opts.maxFps = std::atof(argv[++i]);
+    } else if (std::strcmp(argv[i], "--view") == 0 && i + 2 < argc) {
+      opts.view.x = std::strtoul(argv[++i], nullptr, 10);
+      opts.view.y = std::strtoul(argv[++i], nullptr, 10);
+    } else if (std::strcmp(argv[i], "--zoom") == 0 && i + 1 < argc) {
+      opts.view.zoom = std::strtoul(argv[++i], nullptr, 10);
+    } else if (std::strcmp(argv[i], "--density") == 0) {
+      opts.view.density = true;
+    } else if (std::strcmp(argv[i], "--populate") == 0 && i + 2 < argc) {
+      opts.populateRows = std::strtoul(argv[++i], nullptr, 10);
+      opts.populateCols = std::strtoul(argv[++i], nullptr, 10);
+    } else if (std::strcmp(argv[i], "--bench") == 0) {
+      opts.bench = true;
+    } else if (std::strcmp(argv[i], "--bench-sizes") == 0 && i + 1 < argc) {
+      opts.benchSizes = parseSizeList(argv[++i]);
+    } else if (std::strcmp(argv[i], "--bench-out") == 0 && i + 1 < argc) {
+      opts.benchOut = argv[++i];
+    } else if (std::strcmp(argv[i], "--ensemble") == 0 && i + 1 < argc) {
+      opts.ensemble = std::strtoul(argv[++i], nullptr, 10);
+      if (opts.ensemble == 0) {
+        opts.rows = 0;
+        break;
+      }
+    } else if (std::strcmp(argv[i], "--ensemble-mixes") == 0 && i + 1 < argc) {
+      opts.ensembleMixes = parseMixList(argv[++i]);
+    } else if (std::strcmp(argv[i], "--ensemble-out") == 0 && i + 1 < argc) {
+      opts.ensembleOut = argv[++i];
+    } else if (argv[i][0] != '-') {
+      positional.push_back(std::strtoul(argv[i], nullptr, 10));
+    } else {
+      positional.clear();
+      opts.rows = 0;
+      break;
+    }
+  }
+  if (positional.size() >= 2) {
+    opts.rows = positional[0];
+    opts.cols = positional[1];
+  }
+  if (opts.rows == 0 || opts.cols == 0 || opts.ticks == 0 || opts.benchSizes.empty() ||
+      opts.tickMs < 0 || opts.maxFps < 0 ||
+      (opts.shards > 0 && (!opts.headless || !opts.checkpoint.empty() || !opts.restore.empty() ||
+                           !opts.record.empty() || !opts.series.empty())) ||
+      (!opts.replay.empty() && (opts.shards > 0 || !opts.restore.empty() || !opts.record.empty() ||
+                                !opts.series.empty() || opts.profile)) ||
+      opts.ensembleMixes.empty() ||
+      (!opts.scenario.empty() && (opts.shards > 0 || !opts.restore.empty() ||
+                                  !opts.replay.empty() || opts.populateRows > 0)) ||
+      (!opts.scenarioOut.empty() && (opts.shards > 0 || !opts.replay.empty())) ||
+      (opts.ensemble > 0 && (opts.shards > 0 || !opts.checkpoint.empty() || !opts.restore.empty() ||
+                             !opts.record.empty() || !opts.series.empty() ||
+                             !opts.replay.empty() || !opts.scenario.empty() ||
+                             !opts.scenarioOut.empty() || opts.profile))) {
+    std::cerr << "Usage: " << argv[0]
+              << " [rows cols] [--headless] [--ticks N] [--seed S] [--threads N]"
+              << " [--populate R C]\n"
+              << "       " << std::string(std::strlen(argv[0]), ' ')
+              << " [--rules classic|harsh|lush] [--scenario FILE] [--scenario-out FILE]\n"
+              << "       " << std::string(std::strlen(argv[0]), ' ')
+              << " [--checkpoint FILE [--checkpoint-every N]] [--restore FILE]\n"
+              << "       " << std::string(std::strlen(argv[0]), ' ')
+              << " [--record FILE [--keyframe-every N]] [--series FILE] [--profile]\n"
+              << "       " << std::string(std::strlen(argv[0]), ' ')
+              << " [--tick-ms N] [--fps N] [--view X Y] [--zoom Z] [--density]\n"
+              << "       " << argv[0] << " --replay FILE [--headless] [--from N] [--to N]"
+              << " [--tick-ms N] [--fps N]\n"
+              << "       " << std::string(std::strlen(argv[0]), ' ')
+              << " [--view X Y] [--zoom Z] [--density]\n"
+              << "       " << argv[0] << " rows cols --headless --shards N"
+              << " [--ticks N] [--seed S] [--threads N]\n"
+              << "       " << std::string(std::strlen(argv[0]), ' ')
+              << " [--populate R C] [--profile]\n"
+              << "       " << argv[0] << " rows cols --ensemble N"
+              << " [--ensemble-mixes default,prey-heavy,apex-heavy]\n"
+              << "       " << std::string(std::strlen(argv[0]), ' ')
+              << " [--ensemble-out FILE] [--ticks N] [--seed S] [--threads N] [--populate R C]\n"
+              << "       " << argv[0] << " --bench [--bench-sizes 64,512,4096]"
+              << " [--bench-out FILE] [--ticks N] [--threads N]\n";
+    return false;
+  }
+  return true;
+}
+
+#ifndef _WIN32
+/**
+ * Forks the processes of a sharded run, each owning a band of whole
+ * scheduling tile rows, and connects every band to the ones above and
+ * below it and to rank 0. Returns false, in the original process, if the
+ * grid is too short for that many bands. Rank 0 stays in the calling
+ * process.
+ */
+bool startShards(size_t count, size_t rows, Shard& shard) {
+  size_t tileRows = tileCount(rows);
+  if (tileRows < count || rows / tileRows < kHaloRows) {
+    return false;
+  }
+  signal(SIGPIPE, SIG_IGN);
+  // boundary[b] links band b - 1 (end 1) with band b (end 0)
+  std::vector<std::array<int, 2>> boundary(count);
+  std::vector<std::array<int, 2>> control(count);
+  for (size_t b = 0; b < count; ++b) {
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, boundary[b].data()) != 0 ||
+        (b > 0 && socketpair(AF_UNIX, SOCK_STREAM, 0, control[b].data()) != 0)) {
+      std::perror("socketpair");
+      std::exit(1);
+    }
+  }
+  std::cout.flush();
+  shard.count = count;
+  shard.rank = 0;
+  for (size_t r = 1; r < count; ++r) {
+    pid_t pid = fork();
+    if (pid < 0) {
+      std::perror("fork");
+      std::exit(1);
+    }
+    if (pid == 0) {
+      shard.rank = r;
+      break;
+    }
+  }
+  size_t r = shard.rank;
+  shard.x0 = r * tileRows / count * rows / tileRows;
+  shard.x1 = (r + 1) * tileRows / count * rows / tileRows;
+  shard.up = boundary[r][0];
+  shard.down = boundary[(r + 1) % count][1];
+  for (size_t b = 1; b < count; ++b) {
+    if (r == 0) {
+      shard.workers.push_back(control[b][0]);
+    } else if (b == r) {
+      shard.coordinator = control[b][1];
+    }
+  }
+  // Close the ends that belong to other processes, so that a shard that
+  // dies shows up as a closed link
+  for (size_t b = 0; b < count; ++b) {
+    for (int end = 0; end < 2; ++end) {
+      int fd = boundary[b][end];
+      if (fd != shard.up && fd != shard.down) close(fd);
+      if (b == 0) continue;
+      fd = control[b][end];
+      if (fd != shard.coordinator &&
+          std::find(shard.workers.begin(), shard.workers.end(), fd) == shard.workers.end()) {
+        close(fd);
+      }
+    }
+  }
+  return true;
+}
+
+/**
+ * Waits for the other processes of a sharded run. Returns false if any of
+ * them failed.
+ */
+bool joinShards(const Shard& shard) {
+  bool ok = true;
+  for (size_t r = 1; r < shard.count; ++r) {
+    int status = 0;
+    if (wait(&status) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+      ok = false;
+    }
+  }
+  return ok;
+}
+#endif
+
+/**
+ * Applies the run options to a freshly built or restored ocean and runs
+ * it, or with --scenario-out only saves it as a scenario. Returns the exit
+ * status.
+ */
+template <class Rules>
+int runOcean(Ocean<Rules>& ocean, const Options& opts) {
+  if (!opts.scenarioOut.empty()) {
+    if (!ocean.writeScenario(opts.scenarioOut)) {
+      std::cerr << "Could not write scenario " << opts.scenarioOut << std::endl;
+      return 1;
+    }
+    return 0;
+  }
+  if (opts.threads > 0) {
+    ocean.setThreads(opts.threads);
+  }
+  ocean.setMaxIterations(opts.ticks);
+  ocean.setPacing(opts.tickMs, opts.maxFps);
+  ocean.setViewport(opts.view);
+  if (!opts.checkpoint.empty()) {
+    ocean.setCheckpoint(opts.checkpoint, opts.checkpointEvery);
+  }
+  Recorder recorder(opts.keyframeEvery);
+  if (!opts.record.empty()) {
+    std::string error;
+    if (!recorder.open(opts.record, error)) {
+      std::cerr << "Cannot record: " << error << std::endl;
+      return 1;
+    }
+    ocean.setRecorder(&recorder);
+  }
+  SeriesWriter series;
+  if (!opts.series.empty()) {
+    std::string error;
+    if (!series.open(opts.series, error)) {
+      std::cerr << "Cannot export: " << error << std::endl;
+      return 1;
+    }
+    ocean.setSeries(&series);
+  }
+#ifdef OCEAN_PROFILE
+  if (opts.profile) ocean.startProfile();
+#endif
+  if (opts.headless) {
+    ocean.runHeadless(std::cout);
+  } else {
+    ocean.run();
+  }
+#ifdef OCEAN_PROFILE
+  if (opts.profile) ocean.writeProfile(std::cerr);
+#endif
+  if (!opts.record.empty() && !recorder.close()) {
+    std::cerr << "Could not write recording " << opts.record << std::endl;
+    return 1;
+  }
+  if (!opts.series.empty() && !series.close()) {
+    std::cerr << "Could not write series " << opts.series << std::endl;
+    return 1;
+  }
+  return 0;
+}
+
+/**
+ * Files a run starts from, opened before the rule set is known.
+ */
+struct RunInputs {
+  CheckpointFile checkpoint;
+  RecordingFile recording;
+  ScenarioFile scenario;
+};
+
+/**
+ * Runs whatever the options ask for under one rule set. A checkpoint or
+ * recording to resume from is already open, and was written under Rules.
+ * Returns the exit status.
+ */
+template <class Rules>
+int simulate(const Options& opts, const Area& populated, const RunInputs& inputs) {
+  if (opts.bench) {
+    return runBenchmarks<Rules>(opts.benchSizes, opts.ticksGiven ? opts.ticks : 0, opts.threads,
+                                opts.benchOut);
+  }
+
+  if (opts.ensemble > 0) {
+    return runEnsemble<Rules>(opts.rows, opts.cols, populated, opts.ensembleMixes, opts.ensemble,
+                              opts.seed, opts.ticks, opts.threads, opts.ensembleOut);
+  }
+  if (opts.shards > 0) {
+#ifdef _WIN32
+    std::cerr << "--shards is not supported on Windows" << std::endl;
+    return 1;
+#else
+    Shard shard;
+    if (!startShards(opts.shards, opts.rows, shard)) {
+      std::cerr << "Too few rows for " << opts.shards << " shards" << std::endl;
+      return 1;
+    }
+    int status = 0;
+    {
+      // Every shard uses the tiled schedule, which the bands follow
+      Ocean<Rules> ocean(opts.rows, opts.cols, opts.seed, kDefaultMix, populated, &shard);
+      ocean.setThreads(std::max<size_t>(1, opts.threads));
+      ocean.setMaxIterations(opts.ticks);
+#ifdef OCEAN_PROFILE
+      if (opts.profile) ocean.startProfile();
+#endif
+      ocean.runHeadless(std::cout);
+#ifdef OCEAN_PROFILE
+      // Every shard measures its own band; the first one reports
+      if (opts.profile && shard.rank == 0) ocean.writeProfile(std::cerr);
+#endif
+    }
+    std::cout.flush();
+    if (shard.rank != 0) {
+      std::_Exit(0);
+    }
+    if (!joinShards(shard)) {
+      status = 1;
+    }
+    return status;
+#endif
+  }
+
+  if (!opts.replay.empty()) {
+    Ocean<Rules> ocean(inputs.recording);
+    ocean.setPacing(opts.tickMs, opts.maxFps);
+    ocean.setViewport(opts.view);
+    bool ok = opts.headless
+        ? ocean.replayHeadless(inputs.recording, opts.replayFrom, opts.replayTo, std::cout)
+        : ocean.replay(inputs.recording, opts.replayFrom, opts.replayTo);
+    if (!ok) {
+      std::cerr << "Cannot replay: " << opts.replay << " is corrupt" << std::endl;
+      return 1;
+    }
+    return 0;
+  }
+
+  if (!opts.restore.empty()) {
+    Ocean<Rules> ocean(inputs.checkpoint);
+    return runOcean(ocean, opts);
+  }
+
+  if (!opts.scenario.empty()) {
+    Ocean<Rules> ocean(inputs.scenario, opts.seed);
+    return runOcean(ocean, opts);
+  }
+
+  Ocean<Rules> ocean(opts.rows, opts.cols, opts.seed, kDefaultMix, populated);
+  return runOcean(ocean, opts);
+}
+
 int main(int argc, char* argv[]) {
-  srand(static_cast<unsigned>(time(nullptr)));
 #ifdef _WIN32
   SetConsoleOutputCP(CP_UTF8); // For UTF-8 characters
 #endif
 
-  size_t N = 30; 
-  size_t M = 40;
-  if (argc >= 3) {
-    N = std::atoi(argv[1]);
-    M = std::atoi(argv[2]);
+  Options opts;
+  if (!parseOptions(argc, argv, opts)) {
+    return 1;
+  }
+#ifndef OCEAN_PROFILE
+  if (opts.profile) {
+    std::cerr << "--profile needs a build with -DOCEAN_PROFILE" << std::endl;
+    return 1;
+  }
+#endif
+
+  if (!opts.seedGiven) {
+    opts.seed = static_cast<uint64_t>(time(nullptr));
   }
 
-  Ocean ocean(N, M);
-  ocean.run();
+  Area populated = {0, 0, opts.rows, opts.cols};
+  if (opts.populateRows > 0 && opts.populateCols > 0) {
+    populated.rows = std::min(opts.populateRows, opts.rows);
+    populated.cols = std::min(opts.populateCols, opts.cols);
+    populated.x0 = (opts.rows - populated.rows) / 2;
+    populated.y0 = (opts.cols - populated.cols) / 2;
+  }
 
-  return 0;
+  RunInputs inputs;
+  if (!opts.bench && !opts.replay.empty()) {
+    std::string error;
+    if (!inputs.recording.open(opts.replay, error)) {
+      std::cerr << "Cannot replay: " << error << std::endl;
+      return 1;
+    }
+    opts.rules = static_cast<RuleSet>(inputs.recording.header().rules);
+  }
+  if (!opts.bench && opts.replay.empty() && !opts.restore.empty()) {
+    // Size, seed, species mix and rules come from the checkpoint
+    std::string error;
+    if (!inputs.checkpoint.open(opts.restore, error)) {
+      std::cerr << "Cannot restore: " << error << std::endl;
+      return 1;
+    }
+    opts.rules = static_cast<RuleSet>(inputs.checkpoint.header().rules);
+  }
+  if (!opts.bench && !opts.scenario.empty()) {
+    // The size comes from the scenario
+    std::string error;
+    if (!inputs.scenario.open(opts.scenario, opts.threads, error)) {
+      std::cerr << "Cannot load scenario: " << error << std::endl;
+      return 1;
+    }
+  }
+
+  // The one place a rule set picks the engine it runs on
+  switch (opts.rules) {
+    case RuleSet::Harsh: return simulate<HarshRules>(opts, populated, inputs);
+    case RuleSet::Lush:  return simulate<LushRules>(opts, populated, inputs);
+    default:             return simulate<ClassicRules>(opts, populated, inputs);
+  }
 }